@@ -84,7 +84,7 @@ static void reset_channel(struct channel *);
 static bool check_device_type(struct disk *);
 static void identify_ata_device(struct disk *);
 
-static void select_sector(struct disk *, disk_sector_t);
+static void select_sector(struct disk *, disk_sector_t, size_t cnt);
 static void issue_pio_command(struct channel *, uint8_t command);
 static void input_sector(struct channel *, void *);
 static void output_sector(struct channel *, const void *);
@@ -221,7 +221,7 @@ void disk_read(struct disk *d, disk_sector_t sec_no, void *buffer)
 
     c = d->channel;
     lock_acquire(&c->lock);
-    select_sector(d, sec_no);
+    select_sector(d, sec_no, 1);
     issue_pio_command(c, CMD_READ_SECTOR_RETRY);
     sema_down(&c->completion_wait);
     if (!wait_while_busy(d))
@@ -238,20 +238,41 @@ void disk_read(struct disk *d, disk_sector_t sec_no, void *buffer)
    per-disk locking is unneeded. */
 void disk_write(struct disk *d, disk_sector_t sec_no, const void *buffer)
 {
+    disk_write_multiple(d, sec_no, 1, buffer);
+}
+
+/* Writes CNT consecutive sectors starting at SEC_NO to disk D
+   from BUFFER, which must contain CNT * DISK_SECTOR_SIZE bytes,
+   with a single command.  CNT must be between 1 and
+   DISK_MAX_TRANSFER.  Returns after the disk has acknowledged
+   receiving all of the data.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+void disk_write_multiple(struct disk *d, disk_sector_t sec_no, size_t cnt, const void *buffer)
+{
+    const uint8_t *p = buffer;
     struct channel *c;
+    size_t i;
 
     ASSERT(d != NULL);
     ASSERT(buffer != NULL);
+    ASSERT(cnt > 0 && cnt <= DISK_MAX_TRANSFER);
 
     c = d->channel;
     lock_acquire(&c->lock);
-    select_sector(d, sec_no);
+    select_sector(d, sec_no, cnt);
     issue_pio_command(c, CMD_WRITE_SECTOR_RETRY);
-    if (!wait_while_busy(d))
-        PANIC("%s: disk write failed, sector=%" PRDSNu, d->name, sec_no);
-    output_sector(c, buffer);
-    sema_down(&c->completion_wait);
-    d->write_cnt++;
+
+    /* The disk asks for each sector in turn, and interrupts once it
+       has taken each one in. */
+    for (i = 0; i < cnt; i++)
+    {
+        if (!wait_while_busy(d))
+            PANIC("%s: disk write failed, sector=%" PRDSNu, d->name, sec_no + (disk_sector_t)i);
+        output_sector(c, p + i * DISK_SECTOR_SIZE);
+        sema_down(&c->completion_wait);
+    }
+    d->write_cnt += cnt;
     lock_release(&c->lock);
 }
 
@@ -411,17 +432,18 @@ static void print_ata_string(char *string, size_t size)
 }
 
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
-static void select_sector(struct disk *d, disk_sector_t sec_no)
+   writes SEC_NO and CNT to the disk's sector selection
+   registers.  (We use LBA mode.) */
+static void select_sector(struct disk *d, disk_sector_t sec_no, size_t cnt)
 {
     struct channel *c = d->channel;
 
-    ASSERT(sec_no < d->capacity);
-    ASSERT(sec_no < (1UL << 28));
+    ASSERT(cnt > 0 && cnt <= DISK_MAX_TRANSFER);
+    ASSERT(sec_no + cnt <= d->capacity);
+    ASSERT(sec_no + cnt <= (1UL << 28));
 
     select_device_wait(d);
-    outb(reg_nsect(c), 1);
+    outb(reg_nsect(c), cnt);
     outb(reg_lbal(c), sec_no);
     outb(reg_lbam(c), sec_no >> 8);
     outb(reg_lbah(c), (sec_no >> 16));
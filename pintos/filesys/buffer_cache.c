@@ -0,0 +1,412 @@
+/* buffer_cache.c: Cache of file system disk sectors.
+ *
+ * Every sector the file system reads or writes goes through a small,
+ * fixed set of entries, so that small and repeated accesses to the
+ * same sector cost one disk transfer instead of one each.  Writes only
+ * dirty the entry; the sector reaches the disk when its entry is
+ * evicted or the cache is flushed.  Entries are replaced in CLOCK
+ * order.
+ *
+ * Sectors that a sequential reader is about to want are queued with
+ * buffer_cache_readahead() and read in by the "readahead" thread, so
+ * that the disk works ahead of the reader.
+ *
+ * The "flusher" thread bounds how long written data stays only in
+ * memory.  It wakes up periodically and writes back the sectors that
+ * have been dirty for longer than buffer_cache_dirty_age, in
+ * ascending order, with runs of adjacent sectors going out in one
+ * transfer. */
+
+#include "filesys/buffer_cache.h"
+#include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/filesys.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* A cached sector.  SECTOR and VALID change only with both CACHE_LOCK
+ * and LOCK held, so holding either one keeps them stable.  LOCK also
+ * guards the rest of the entry, and is held across the disk transfer
+ * that fills or writes back DATA. */
+struct cache_entry {
+    struct lock lock;     /* Held while DATA is used. */
+    disk_sector_t sector; /* Sector cached here, if VALID. */
+    bool valid;           /* Does the entry hold a sector? */
+    bool dirty;           /* Has DATA changed since it was last written? */
+    bool accessed;        /* Used since the clock hand last passed? */
+    int64_t dirty_since;  /* Timer tick at which DATA became dirty. */
+    uint8_t *data;        /* DISK_SECTOR_SIZE bytes. */
+};
+
+size_t buffer_cache_size = BUFFER_CACHE_SIZE;
+int64_t buffer_cache_dirty_age = 3 * TIMER_FREQ;
+
+static struct cache_entry *cache;
+static struct lock cache_lock; /* Protects which sector is where, and CLOCK_HAND. */
+static size_t clock_hand;
+
+/* Read-ahead requests, a ring of sectors.  When it is full, new
+ * requests are dropped. */
+#define RA_QUEUE_SIZE 32
+static disk_sector_t ra_queue[RA_QUEUE_SIZE];
+static size_t ra_head, ra_cnt;
+static struct lock ra_lock;
+static struct condition ra_ready;
+
+/* Write-back of dirty sectors in sector order. */
+#define FLUSH_INTERVAL (TIMER_FREQ / 2) /* Timer ticks between flusher runs. */
+#define FLUSH_MAX_RUN 16                /* Most sectors written in one transfer. */
+static struct lock flush_lock;          /* Protects FLUSH_LIST and FLUSH_BUF. */
+static struct cache_entry **flush_list; /* Entries to write back, by sector. */
+static uint8_t flush_buf[FLUSH_MAX_RUN * DISK_SECTOR_SIZE];
+
+/* Statistics. */
+static long long hit_cnt;       /* Accesses served from the cache. */
+static long long miss_cnt;      /* Accesses that had to claim an entry. */
+static long long writeback_cnt; /* Dirty sectors written to disk. */
+static long long transfer_cnt;  /* Disk transfers that wrote them. */
+static long long readahead_cnt; /* Sectors read in ahead of use. */
+
+static void readahead_thread(void *aux);
+static void flusher_thread(void *aux);
+
+/* Sets up the buffer cache, with BUFFER_CACHE_SIZE entries. */
+void buffer_cache_init(void)
+{
+    size_t i;
+    uint8_t *data;
+
+    if (buffer_cache_size == 0)
+        buffer_cache_size = 1;
+    cache = calloc(buffer_cache_size, sizeof *cache);
+    flush_list = calloc(buffer_cache_size, sizeof *flush_list);
+    data = palloc_get_multiple(PAL_ASSERT, DIV_ROUND_UP(buffer_cache_size * DISK_SECTOR_SIZE, PGSIZE));
+    if (cache == NULL || flush_list == NULL)
+        PANIC("buffer cache allocation failed");
+
+    lock_init(&cache_lock);
+    for (i = 0; i < buffer_cache_size; i++)
+    {
+        lock_init(&cache[i].lock);
+        cache[i].data = data + i * DISK_SECTOR_SIZE;
+    }
+
+    lock_init(&ra_lock);
+    cond_init(&ra_ready);
+    lock_init(&flush_lock);
+    thread_create("readahead", PRI_DEFAULT, readahead_thread, NULL);
+    thread_create("flusher", PRI_DEFAULT, flusher_thread, NULL);
+}
+
+/* Returns the entry that holds SECTOR, or NULL if there is none.
+ * Caller holds CACHE_LOCK. */
+static struct cache_entry *cache_lookup(disk_sector_t sector)
+{
+    size_t i;
+
+    for (i = 0; i < buffer_cache_size; i++)
+        if (cache[i].valid && cache[i].sector == sector)
+            return &cache[i];
+    return NULL;
+}
+
+/* Writes E's sector back to disk if it is dirty.  Caller holds E's
+ * lock. */
+static void cache_writeback(struct cache_entry *e)
+{
+    if (e->valid && e->dirty)
+    {
+        disk_write(filesys_disk, e->sector, e->data);
+        e->dirty = false;
+        writeback_cnt++;
+        transfer_cnt++;
+    }
+}
+
+/* Picks a clean entry to reuse by the clock algorithm and returns it
+ * locked.  Skips entries in use, unless every entry has been in use
+ * for two sweeps.  Caller holds CACHE_LOCK.
+ *
+ * No disk transfer happens under CACHE_LOCK.  A dirty victim is
+ * written back with only its own lock held, so that it still holds
+ * its sector meanwhile and other threads wait on it instead of
+ * reading the old contents from disk.  The same goes for waiting on an
+ * entry in use.  In either case CACHE_LOCK is released and NULL is
+ * returned, and the caller must look its sector up again. */
+static struct cache_entry *cache_evict(void)
+{
+    struct cache_entry *e;
+    size_t n;
+
+    for (n = 0;; n++)
+    {
+        e = &cache[clock_hand];
+        clock_hand = (clock_hand + 1) % buffer_cache_size;
+
+        if (!lock_try_acquire(&e->lock))
+        {
+            if (n < 2 * buffer_cache_size)
+                continue;
+            lock_release(&cache_lock);
+            lock_acquire(&e->lock);
+            lock_release(&e->lock);
+            return NULL;
+        }
+
+        if (e->valid && e->accessed && n < 2 * buffer_cache_size)
+        {
+            e->accessed = false;
+            lock_release(&e->lock);
+            continue;
+        }
+        if (e->valid && e->dirty)
+        {
+            lock_release(&cache_lock);
+            cache_writeback(e);
+            lock_release(&e->lock);
+            return NULL;
+        }
+        return e;
+    }
+}
+
+/* Claims an entry for SECTOR, which is not in the cache, and returns
+ * it locked.  Claiming happens under CACHE_LOCK, which the caller
+ * holds and this function releases, so that no one else claims
+ * another entry for SECTOR.  Others that find it wait on its lock
+ * until the caller fills it.  Returns NULL if cache_evict() had to
+ * release CACHE_LOCK first; the caller then starts over. */
+static struct cache_entry *cache_claim(disk_sector_t sector)
+{
+    struct cache_entry *e = cache_evict();
+
+    if (e == NULL)
+        return NULL;
+    e->sector = sector;
+    e->valid = true;
+    e->dirty = false;
+    e->accessed = true;
+    lock_release(&cache_lock);
+    return e;
+}
+
+/* Returns the entry for SECTOR, locked.  Reads the sector in on a
+ * miss, unless FILL is false because the caller is about to overwrite
+ * all of it. */
+static struct cache_entry *cache_get(disk_sector_t sector, bool fill)
+{
+    struct cache_entry *e;
+
+    for (;;)
+    {
+        lock_acquire(&cache_lock);
+        e = cache_lookup(sector);
+        if (e == NULL)
+        {
+            e = cache_claim(sector);
+            if (e != NULL)
+                break;
+            continue;
+        }
+        lock_release(&cache_lock);
+
+        /* The entry may be reused while we wait for it. */
+        lock_acquire(&e->lock);
+        if (e->valid && e->sector == sector)
+        {
+            e->accessed = true;
+            hit_cnt++;
+            return e;
+        }
+        lock_release(&e->lock);
+    }
+
+    miss_cnt++;
+    if (fill)
+        disk_read(filesys_disk, sector, e->data);
+    return e;
+}
+
+/* Reads SIZE bytes at offset OFS within SECTOR into BUFFER. */
+void buffer_cache_read(disk_sector_t sector, void *buffer, size_t ofs, size_t size)
+{
+    struct cache_entry *e;
+
+    ASSERT(ofs + size <= DISK_SECTOR_SIZE);
+
+    e = cache_get(sector, true);
+    memcpy(buffer, e->data + ofs, size);
+    lock_release(&e->lock);
+}
+
+/* Writes SIZE bytes from BUFFER at offset OFS within SECTOR.  The
+ * sector is only read from disk first if the write covers part of
+ * it. */
+void buffer_cache_write(disk_sector_t sector, const void *buffer, size_t ofs, size_t size)
+{
+    struct cache_entry *e;
+
+    ASSERT(ofs + size <= DISK_SECTOR_SIZE);
+
+    e = cache_get(sector, size < DISK_SECTOR_SIZE);
+    memcpy(e->data + ofs, buffer, size);
+    if (!e->dirty)
+        e->dirty_since = timer_ticks();
+    e->dirty = true;
+    lock_release(&e->lock);
+}
+
+/* Asks for SECTOR to be read into the cache in the background, if
+ * it is not there already. */
+void buffer_cache_readahead(disk_sector_t sector)
+{
+    lock_acquire(&ra_lock);
+    if (ra_cnt < RA_QUEUE_SIZE)
+    {
+        ra_queue[(ra_head + ra_cnt++) % RA_QUEUE_SIZE] = sector;
+        cond_signal(&ra_ready, &ra_lock);
+    }
+    lock_release(&ra_lock);
+}
+
+/* Reads the sectors queued by buffer_cache_readahead() into the
+ * cache, one at a time. */
+static void readahead_thread(void *aux UNUSED)
+{
+    for (;;)
+    {
+        struct cache_entry *e;
+        disk_sector_t sector;
+
+        lock_acquire(&ra_lock);
+        while (ra_cnt == 0)
+            cond_wait(&ra_ready, &ra_lock);
+        sector = ra_queue[ra_head];
+        ra_head = (ra_head + 1) % RA_QUEUE_SIZE;
+        ra_cnt--;
+        lock_release(&ra_lock);
+
+        do
+        {
+            lock_acquire(&cache_lock);
+            if (cache_lookup(sector) != NULL)
+            {
+                lock_release(&cache_lock);
+                e = NULL;
+                break;
+            }
+        } while ((e = cache_claim(sector)) == NULL);
+        if (e == NULL)
+            continue;
+        disk_read(filesys_disk, sector, e->data);
+        readahead_cnt++;
+        lock_release(&e->lock);
+    }
+}
+
+/* Orders cache entries, given as pointers, by sector. */
+static int flush_compare(const void *a_, const void *b_)
+{
+    const struct cache_entry *a = *(struct cache_entry *const *)a_;
+    const struct cache_entry *b = *(struct cache_entry *const *)b_;
+
+    return a->sector < b->sector ? -1 : a->sector > b->sector;
+}
+
+/* Writes the CNT entries in LIST, which hold adjacent sectors in
+ * order and are locked by the caller, to disk in one transfer. */
+static void flush_run(struct cache_entry **list, size_t cnt)
+{
+    size_t i;
+
+    for (i = 0; i < cnt; i++)
+        memcpy(flush_buf + i * DISK_SECTOR_SIZE, list[i]->data, DISK_SECTOR_SIZE);
+    disk_write_multiple(filesys_disk, list[0]->sector, cnt, flush_buf);
+    for (i = 0; i < cnt; i++)
+    {
+        list[i]->dirty = false;
+        lock_release(&list[i]->lock);
+    }
+    writeback_cnt += cnt;
+    transfer_cnt++;
+}
+
+/* Writes back the sectors that have been dirty for at least AGE
+ * timer ticks, in ascending order, merging runs of adjacent sectors
+ * into single transfers. */
+static void flush_older(int64_t age)
+{
+    int64_t now = timer_ticks();
+    size_t cnt = 0, run = 0;
+    size_t i;
+
+    lock_acquire(&flush_lock);
+
+    /* Pick the entries to write.  They may change before they are
+     * locked, so they are checked again below. */
+    lock_acquire(&cache_lock);
+    for (i = 0; i < buffer_cache_size; i++)
+        if (cache[i].valid && cache[i].dirty && now - cache[i].dirty_since >= age)
+            flush_list[cnt++] = &cache[i];
+    lock_release(&cache_lock);
+    qsort(flush_list, cnt, sizeof *flush_list, flush_compare);
+
+    /* Lock each entry until its run is on disk, so that nothing reads
+     * the old contents from disk in the meantime.  The run is built at
+     * the front of FLUSH_LIST, over entries already looked at. */
+    for (i = 0; i < cnt; i++)
+    {
+        struct cache_entry *e = flush_list[i];
+        disk_sector_t sector = e->sector;
+
+        lock_acquire(&e->lock);
+        if (!e->valid || !e->dirty || e->sector != sector)
+        {
+            lock_release(&e->lock);
+            continue;
+        }
+        if (run > 0 && (run == FLUSH_MAX_RUN || flush_list[run - 1]->sector + 1 != sector))
+        {
+            flush_run(flush_list, run);
+            run = 0;
+        }
+        flush_list[run++] = e;
+    }
+    if (run > 0)
+        flush_run(flush_list, run);
+
+    lock_release(&flush_lock);
+}
+
+/* Writes back old dirty sectors every FLUSH_INTERVAL timer ticks. */
+static void flusher_thread(void *aux UNUSED)
+{
+    for (;;)
+    {
+        timer_sleep(FLUSH_INTERVAL);
+        flush_older(buffer_cache_dirty_age);
+    }
+}
+
+/* Writes every dirty sector in the cache to disk. */
+void buffer_cache_flush(void)
+{
+    flush_older(0);
+}
+
+/* Prints buffer cache statistics. */
+void buffer_cache_print_stats(void)
+{
+    long long total = hit_cnt + miss_cnt;
+
+    printf("Buffer cache: %lld hits, %lld misses (%lld%% hit rate), %lld read-aheads, %lld write-backs in %lld "
+           "transfers\n",
+           hit_cnt, miss_cnt, total > 0 ? hit_cnt * 100 / total : 0, readahead_cnt, writeback_cnt, transfer_cnt);
+}
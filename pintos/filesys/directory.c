@@ -1,15 +1,19 @@
 #include "filesys/directory.h"
+#include <stddef.h>
 #include <stdio.h>
 #include <string.h>
+#include <hash.h>
 #include <list.h>
+#include <round.h>
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
 /* A directory. */
 struct dir {
     struct inode *inode; /* Backing store. */
-    off_t pos;           /* Current position. */
+    off_t pos;           /* Current position, in entries. */
 };
 
 /* A single directory entry. */
@@ -19,11 +23,254 @@ struct dir_entry {
     bool in_use;                /* In use or free? */
 };
 
+/* Hashed layout.  A directory is an array of buckets, one per sector.
+ * An entry goes in the bucket its name hashes to or, if that one is
+ * full, in the first bucket after it with room; each full bucket
+ * passed over is marked as overflowing, so a lookup stops at the
+ * first bucket that is not.  When every bucket is full, the directory
+ * doubles its number of buckets and rehashes its entries. */
+#define BUCKET_ENTRIES ((DISK_SECTOR_SIZE - sizeof(bool)) / sizeof(struct dir_entry))
+
+/* On-disk bucket.  Must be at most DISK_SECTOR_SIZE bytes long. */
+struct dir_bucket {
+    struct dir_entry entries[BUCKET_ENTRIES]; /* Entries. */
+    bool overflow;                            /* Entries hashed here went further? */
+};
+
+/* In-memory index of a directory.  It holds a one-byte tag of the
+ * name hash of every entry, or 0 for a free slot, and the overflow
+ * flag of every bucket.  A lookup reads only the entries whose tag
+ * matches, and finds an absent name without reading any.  The
+ * indexes of the DIR_INDEX_CNT directories used most recently are
+ * kept, and every change to a directory updates its index. */
+#define DIR_INDEX_CNT 8
+
+struct dir_index {
+    struct list_elem elem; /* Element in dir_indexes. */
+    disk_sector_t sector;  /* Inode sector of the directory. */
+    size_t bucket_cnt;     /* Number of buckets. */
+    uint8_t *tags;         /* BUCKET_ENTRIES tags per bucket. */
+    bool *overflow;        /* Overflow flag per bucket. */
+};
+
+/* Directory indexes, most recently used first. */
+static struct list dir_indexes;
+
+/* Directory entry cache.  It maps a name in a directory to the inode
+ * sector of the file it names, or records that no such file exists,
+ * for the DENTRY_CNT names looked up most recently, so that looking
+ * one up again reads no directory at all.  dir_add() and dir_remove()
+ * drop the entry for the name they change. */
+#define DENTRY_CNT 64
+
+struct dentry {
+    struct hash_elem hash_elem; /* Element in dentries. */
+    struct list_elem lru_elem;  /* Element in dentry_lru. */
+    disk_sector_t parent;       /* Inode sector of the directory. */
+    char name[NAME_MAX + 1];    /* Null terminated file name. */
+    bool present;               /* Does the directory have NAME? */
+    disk_sector_t inode_sector; /* Sector of NAME's inode, if PRESENT. */
+};
+
+/* Cached entries, and the same entries most recently used first. */
+static struct hash dentries;
+static struct list dentry_lru;
+
+/* Serializes changes to directories, their indexes and the entry
+ * cache. */
+static struct lock dir_lock;
+
+static hash_hash_func dentry_hash;
+static hash_less_func dentry_less;
+
+/* Initializes the directory module. */
+void dir_init(void)
+{
+    list_init(&dir_indexes);
+    if (!hash_init(&dentries, dentry_hash, dentry_less, NULL))
+        PANIC("directory entry cache creation failed");
+    list_init(&dentry_lru);
+    lock_init(&dir_lock);
+}
+
+/* Returns a hash of dentry E's directory and name. */
+static uint64_t dentry_hash(const struct hash_elem *e, void *aux UNUSED)
+{
+    const struct dentry *d = hash_entry(e, struct dentry, hash_elem);
+    return hash_string(d->name) ^ hash_int(d->parent);
+}
+
+/* Orders dentries A and B by directory, then name. */
+static bool dentry_less(const struct hash_elem *a_, const struct hash_elem *b_, void *aux UNUSED)
+{
+    const struct dentry *a = hash_entry(a_, struct dentry, hash_elem);
+    const struct dentry *b = hash_entry(b_, struct dentry, hash_elem);
+
+    if (a->parent != b->parent)
+        return a->parent < b->parent;
+    return strcmp(a->name, b->name) < 0;
+}
+
+/* Returns the cached entry for NAME in the directory whose inode is
+ * in PARENT, or a null pointer if there is none. */
+static struct dentry *dentry_find(disk_sector_t parent, const char *name)
+{
+    struct dentry key, *d;
+    struct hash_elem *e;
+
+    key.parent = parent;
+    strlcpy(key.name, name, sizeof key.name);
+    e = hash_find(&dentries, &key.hash_elem);
+    if (e == NULL)
+        return NULL;
+
+    d = hash_entry(e, struct dentry, hash_elem);
+    list_remove(&d->lru_elem);
+    list_push_front(&dentry_lru, &d->lru_elem);
+    return d;
+}
+
+/* Frees cached entry D. */
+static void dentry_free(struct dentry *d)
+{
+    hash_delete(&dentries, &d->hash_elem);
+    list_remove(&d->lru_elem);
+    free(d);
+}
+
+/* Caches whether the directory whose inode is in PARENT has NAME and,
+ * if PRESENT, the sector of its inode.  NAME must not be cached
+ * yet. */
+static void dentry_add(disk_sector_t parent, const char *name, bool present, disk_sector_t inode_sector)
+{
+    struct dentry *d = malloc(sizeof *d);
+
+    if (d == NULL)
+        return;
+    if (hash_size(&dentries) == DENTRY_CNT)
+        dentry_free(list_entry(list_back(&dentry_lru), struct dentry, lru_elem));
+    d->parent = parent;
+    strlcpy(d->name, name, sizeof d->name);
+    d->present = present;
+    d->inode_sector = inode_sector;
+    hash_insert(&dentries, &d->hash_elem);
+    list_push_front(&dentry_lru, &d->lru_elem);
+}
+
+/* Drops the cached entry for NAME in DIR, if there is one. */
+static void dentry_drop(const struct dir *dir, const char *name)
+{
+    struct dentry *d = dentry_find(inode_get_inumber(dir->inode), name);
+
+    if (d != NULL)
+        dentry_free(d);
+}
+
+/* Returns the byte offset of entry IDX of a directory. */
+static off_t entry_ofs(size_t idx)
+{
+    return idx / BUCKET_ENTRIES * DISK_SECTOR_SIZE + idx % BUCKET_ENTRIES * sizeof(struct dir_entry);
+}
+
+/* Returns the byte offset of the overflow flag of BUCKET. */
+static off_t overflow_ofs(size_t bucket)
+{
+    return bucket * DISK_SECTOR_SIZE + offsetof(struct dir_bucket, overflow);
+}
+
+/* Returns the index tag of a name whose hash is HASH. */
+static uint8_t hash_tag(uint64_t hash)
+{
+    uint8_t tag = hash >> 56;
+    return tag != 0 ? tag : 1;
+}
+
+/* Frees INDEX. */
+static void index_free(struct dir_index *index)
+{
+    list_remove(&index->elem);
+    free(index->tags);
+    free(index->overflow);
+    free(index);
+}
+
+/* Sets up INDEX for BUCKET_CNT buckets that are all empty.  Returns
+ * false if memory runs out. */
+static bool index_reset(struct dir_index *index, size_t bucket_cnt)
+{
+    uint8_t *tags = calloc(bucket_cnt * BUCKET_ENTRIES, sizeof *tags);
+    bool *overflow = calloc(bucket_cnt, sizeof *overflow);
+
+    if (tags == NULL || overflow == NULL)
+    {
+        free(tags);
+        free(overflow);
+        return false;
+    }
+    free(index->tags);
+    free(index->overflow);
+    index->bucket_cnt = bucket_cnt;
+    index->tags = tags;
+    index->overflow = overflow;
+    return true;
+}
+
+/* Returns the index of directory INODE, reading the directory to
+ * build one if there is none yet.  Returns a null pointer if memory
+ * runs out. */
+static struct dir_index *index_get(struct inode *inode)
+{
+    disk_sector_t sector = inode_get_inumber(inode);
+    struct dir_index *index;
+    struct dir_bucket *bucket;
+    struct list_elem *e;
+    size_t b, i;
+
+    for (e = list_begin(&dir_indexes); e != list_end(&dir_indexes); e = list_next(e))
+    {
+        index = list_entry(e, struct dir_index, elem);
+        if (index->sector == sector)
+        {
+            list_remove(e);
+            list_push_front(&dir_indexes, e);
+            return index;
+        }
+    }
+
+    index = calloc(1, sizeof *index);
+    bucket = malloc(sizeof *bucket);
+    if (index == NULL || bucket == NULL || !index_reset(index, inode_length(inode) / DISK_SECTOR_SIZE))
+    {
+        free(index);
+        free(bucket);
+        return NULL;
+    }
+    index->sector = sector;
+    for (b = 0; b < index->bucket_cnt; b++)
+    {
+        inode_read_at(inode, bucket, sizeof *bucket, b * DISK_SECTOR_SIZE);
+        for (i = 0; i < BUCKET_ENTRIES; i++)
+            if (bucket->entries[i].in_use)
+                index->tags[b * BUCKET_ENTRIES + i] = hash_tag(hash_string(bucket->entries[i].name));
+        index->overflow[b] = bucket->overflow;
+    }
+    free(bucket);
+
+    if (list_size(&dir_indexes) == DIR_INDEX_CNT)
+        index_free(list_entry(list_back(&dir_indexes), struct dir_index, elem));
+    list_push_front(&dir_indexes, &index->elem);
+    return index;
+}
+
 /* Creates a directory with space for ENTRY_CNT entries in the
  * given SECTOR.  Returns true if successful, false on failure. */
 bool dir_create(disk_sector_t sector, size_t entry_cnt)
 {
-    return inode_create(sector, entry_cnt * sizeof(struct dir_entry));
+    size_t bucket_cnt = DIV_ROUND_UP(entry_cnt, BUCKET_ENTRIES);
+
+    ASSERT(sizeof(struct dir_bucket) <= DISK_SECTOR_SIZE);
+
+    return inode_create(sector, (bucket_cnt > 0 ? bucket_cnt : 1) * DISK_SECTOR_SIZE);
 }
 
 /* Opens and returns the directory for the given INODE, of which
@@ -74,46 +321,183 @@ struct inode *dir_get_inode(struct dir *dir)
     return dir->inode;
 }
 
-/* Searches DIR for a file with the given NAME.
- * If successful, returns true, sets *EP to the directory entry
- * if EP is non-null, and sets *OFSP to the byte offset of the
- * directory entry if OFSP is non-null.
- * otherwise, returns false and ignores EP and OFSP. */
-static bool lookup(const struct dir *dir, const char *name, struct dir_entry *ep, off_t *ofsp)
+/* Searches DIR, whose index is INDEX, for a file with the given
+ * NAME.  If successful, returns true, sets *EP to the directory entry
+ * if EP is non-null, and sets *IDXP to the number of the directory
+ * entry if IDXP is non-null.
+ * otherwise, returns false and ignores EP and IDXP. */
+static bool lookup(const struct dir *dir, const struct dir_index *index, const char *name, struct dir_entry *ep,
+                   size_t *idxp)
 {
+    uint64_t hash = hash_string(name);
+    uint8_t tag = hash_tag(hash);
+    size_t b = hash % index->bucket_cnt;
     struct dir_entry e;
-    size_t ofs;
+    size_t n, i;
 
     ASSERT(dir != NULL);
     ASSERT(name != NULL);
 
-    for (ofs = 0; inode_read_at(dir->inode, &e, sizeof e, ofs) == sizeof e; ofs += sizeof e)
-        if (e.in_use && !strcmp(name, e.name))
+    for (n = 0; n < index->bucket_cnt; n++, b = (b + 1) % index->bucket_cnt)
+    {
+        for (i = b * BUCKET_ENTRIES; i < (b + 1) * BUCKET_ENTRIES; i++)
+            if (index->tags[i] == tag && inode_read_at(dir->inode, &e, sizeof e, entry_ofs(i)) == sizeof e &&
+                e.in_use && !strcmp(name, e.name))
+            {
+                if (ep != NULL)
+                    *ep = e;
+                if (idxp != NULL)
+                    *idxp = i;
+                return true;
+            }
+        if (!index->overflow[b])
+            break;
+    }
+    return false;
+}
+
+/* Finds a free slot in DIR, whose index is INDEX, for an entry whose
+ * name hashes to HASH, and stores its number into *IDXP.  Marks each
+ * full bucket passed over as overflowing.  Returns false if every
+ * bucket is full or a disk error occurs. */
+static bool slot_find(struct dir *dir, struct dir_index *index, uint64_t hash, size_t *idxp)
+{
+    size_t b = hash % index->bucket_cnt;
+    size_t n, i;
+
+    for (n = 0; n < index->bucket_cnt; n++, b = (b + 1) % index->bucket_cnt)
+    {
+        for (i = b * BUCKET_ENTRIES; i < (b + 1) * BUCKET_ENTRIES; i++)
+            if (index->tags[i] == 0)
+            {
+                *idxp = i;
+                return true;
+            }
+        if (!index->overflow[b])
         {
-            if (ep != NULL)
-                *ep = e;
-            if (ofsp != NULL)
-                *ofsp = ofs;
-            return true;
+            bool overflow = true;
+            if (inode_write_at(dir->inode, &overflow, sizeof overflow, overflow_ofs(b)) != sizeof overflow)
+                return false;
+            index->overflow[b] = true;
         }
+    }
     return false;
 }
 
+/* Writes E, an entry in use, into slot IDX of DIR, whose index is
+ * INDEX.  Returns true if successful, false on a disk error. */
+static bool entry_put(struct dir *dir, struct dir_index *index, size_t idx, const struct dir_entry *e)
+{
+    if (inode_write_at(dir->inode, e, sizeof *e, entry_ofs(idx)) != sizeof *e)
+        return false;
+    index->tags[idx] = hash_tag(hash_string(e->name));
+    return true;
+}
+
+/* Doubles the number of buckets of DIR, whose index is INDEX and
+ * whose buckets are all full, and rehashes its entries.  Each new
+ * bucket is added by a single sector write, which either extends the
+ * directory or leaves it as it was, so if the disk fills up partway
+ * the entries are rehashed over the buckets that were added.  Returns
+ * false if no bucket could be added, leaving DIR as it was, or if a
+ * disk error loses entries, in which case INDEX is freed so that the
+ * next use rebuilds it from what is on disk. */
+static bool dir_grow(struct dir *dir, struct dir_index *index)
+{
+    size_t bucket_cnt = index->bucket_cnt;
+    size_t entry_cnt = bucket_cnt * BUCKET_ENTRIES;
+    struct dir_entry *entries = malloc(entry_cnt * sizeof *entries);
+    uint8_t *zeros = calloc(1, DISK_SECTOR_SIZE);
+    struct dir_index grown = {.tags = NULL, .overflow = NULL};
+    bool success = false;
+    size_t b, i;
+
+    /* Everything that can run out is taken before DIR changes. */
+    if (entries == NULL || zeros == NULL || !index_reset(&grown, 2 * bucket_cnt))
+        goto done;
+    for (i = 0; i < entry_cnt; i++)
+        inode_read_at(dir->inode, &entries[i], sizeof *entries, entry_ofs(i));
+
+    /* Add the new buckets. */
+    for (b = bucket_cnt; b < 2 * bucket_cnt; b++)
+        if (inode_write_at(dir->inode, zeros, DISK_SECTOR_SIZE, b * DISK_SECTOR_SIZE) != DISK_SECTOR_SIZE)
+            break;
+    if (b == bucket_cnt)
+        goto done;
+
+    /* Switch INDEX to the grown, empty buckets, then empty the old
+     * ones.  Every write from here on is to a sector the directory
+     * already has. */
+    free(index->tags);
+    free(index->overflow);
+    index->bucket_cnt = b;
+    index->tags = grown.tags;
+    index->overflow = grown.overflow;
+    grown.tags = NULL;
+    grown.overflow = NULL;
+    success = true;
+    for (b = 0; b < bucket_cnt; b++)
+        if (inode_write_at(dir->inode, zeros, DISK_SECTOR_SIZE, b * DISK_SECTOR_SIZE) != DISK_SECTOR_SIZE)
+            success = false;
+
+    /* There are more slots than entries now, so every entry finds
+     * one. */
+    for (i = 0; success && i < entry_cnt; i++)
+    {
+        size_t idx;
+        if (entries[i].in_use &&
+            !(slot_find(dir, index, hash_string(entries[i].name), &idx) && entry_put(dir, index, idx, &entries[i])))
+            success = false;
+    }
+    if (!success)
+        index_free(index);
+
+done:
+    free(grown.tags);
+    free(grown.overflow);
+    free(entries);
+    free(zeros);
+    return success;
+}
+
 /* Searches DIR for a file with the given NAME
  * and returns true if one exists, false otherwise.
  * On success, sets *INODE to an inode for the file, otherwise to
  * a null pointer.  The caller must close *INODE. */
 bool dir_lookup(const struct dir *dir, const char *name, struct inode **inode)
 {
+    disk_sector_t parent;
+    struct dentry *d;
     struct dir_entry e;
+    bool found = false;
 
     ASSERT(dir != NULL);
     ASSERT(name != NULL);
 
-    if (lookup(dir, name, &e, NULL))
+    /* No file has a name too long to be cached. */
+    *inode = NULL;
+    if (strlen(name) > NAME_MAX)
+        return false;
+
+    lock_acquire(&dir_lock);
+    parent = inode_get_inumber(dir->inode);
+    d = dentry_find(parent, name);
+    if (d != NULL)
+    {
+        found = d->present;
+        e.inode_sector = d->inode_sector;
+    } else
+    {
+        struct dir_index *index = index_get(dir->inode);
+        if (index != NULL)
+        {
+            found = lookup(dir, index, name, &e, NULL);
+            dentry_add(parent, name, found, found ? e.inode_sector : 0);
+        }
+    }
+    if (found)
         *inode = inode_open(e.inode_sector);
-    else
-        *inode = NULL;
+    lock_release(&dir_lock);
 
     return *inode != NULL;
 }
@@ -126,8 +510,9 @@ bool dir_lookup(const struct dir *dir, const char *name, struct inode **inode)
  * error occurs. */
 bool dir_add(struct dir *dir, const char *name, disk_sector_t inode_sector)
 {
+    struct dir_index *index;
     struct dir_entry e;
-    off_t ofs;
+    size_t idx;
     bool success = false;
 
     ASSERT(dir != NULL);
@@ -137,28 +522,28 @@ bool dir_add(struct dir *dir, const char *name, disk_sector_t inode_sector)
     if (*name == '\0' || strlen(name) > NAME_MAX)
         return false;
 
+    lock_acquire(&dir_lock);
+
     /* Check that NAME is not in use. */
-    if (lookup(dir, name, NULL, NULL))
+    index = index_get(dir->inode);
+    if (index == NULL || lookup(dir, index, name, NULL, NULL))
         goto done;
 
-    /* Set OFS to offset of free slot.
-     * If there are no free slots, then it will be set to the
-     * current end-of-file.
-
-     * inode_read_at() will only return a short read at end of file.
-     * Otherwise, we'd need to verify that we didn't get a short
-     * read due to something intermittent such as low memory. */
-    for (ofs = 0; inode_read_at(dir->inode, &e, sizeof e, ofs) == sizeof e; ofs += sizeof e)
-        if (!e.in_use)
-            break;
+    /* Find a free slot, growing the directory if there is none. */
+    if (!slot_find(dir, index, hash_string(name), &idx) &&
+        !(dir_grow(dir, index) && slot_find(dir, index, hash_string(name), &idx)))
+        goto done;
 
     /* Write slot. */
     e.in_use = true;
     strlcpy(e.name, name, sizeof e.name);
     e.inode_sector = inode_sector;
-    success = inode_write_at(dir->inode, &e, sizeof e, ofs) == sizeof e;
+    success = entry_put(dir, index, idx, &e);
+    if (success)
+        dentry_drop(dir, name);
 
 done:
+    lock_release(&dir_lock);
     return success;
 }
 
@@ -167,16 +552,20 @@ done:
  * which occurs only if there is no file with the given NAME. */
 bool dir_remove(struct dir *dir, const char *name)
 {
+    struct dir_index *index;
     struct dir_entry e;
     struct inode *inode = NULL;
     bool success = false;
-    off_t ofs;
+    size_t idx;
 
     ASSERT(dir != NULL);
     ASSERT(name != NULL);
 
+    lock_acquire(&dir_lock);
+
     /* Find directory entry. */
-    if (!lookup(dir, name, &e, &ofs))
+    index = index_get(dir->inode);
+    if (index == NULL || !lookup(dir, index, name, &e, &idx))
         goto done;
 
     /* Open inode. */
@@ -186,14 +575,17 @@ bool dir_remove(struct dir *dir, const char *name)
 
     /* Erase directory entry. */
     e.in_use = false;
-    if (inode_write_at(dir->inode, &e, sizeof e, ofs) != sizeof e)
+    if (inode_write_at(dir->inode, &e, sizeof e, entry_ofs(idx)) != sizeof e)
         goto done;
+    index->tags[idx] = 0;
+    dentry_drop(dir, name);
 
     /* Remove inode. */
     inode_remove(inode);
     success = true;
 
 done:
+    lock_release(&dir_lock);
     inode_close(inode);
     return success;
 }
@@ -205,9 +597,9 @@ bool dir_readdir(struct dir *dir, char name[NAME_MAX + 1])
 {
     struct dir_entry e;
 
-    while (inode_read_at(dir->inode, &e, sizeof e, dir->pos) == sizeof e)
+    while (inode_read_at(dir->inode, &e, sizeof e, entry_ofs(dir->pos)) == sizeof e)
     {
-        dir->pos += sizeof e;
+        dir->pos++;
         if (e.in_use)
         {
             strlcpy(name, e.name, NAME_MAX + 1);
@@ -1,4 +1,5 @@
 #include "filesys/fat.h"
+#include <bitmap.h>
 #include "devices/disk.h"
 #include "filesys/filesys.h"
 #include "threads/malloc.h"
@@ -16,6 +17,9 @@ struct fat_boot {
     unsigned int root_dir_cluster;
 };
 
+/* Number of FAT entries in a sector. */
+#define FAT_PER_SECTOR (DISK_SECTOR_SIZE / sizeof(cluster_t))
+
 /* FAT FS */
 struct fat_fs {
     struct fat_boot bs;
@@ -24,12 +28,21 @@ struct fat_fs {
     disk_sector_t data_start;
     cluster_t last_clst;
     struct lock write_lock;
+
+    /* Index of the in-memory FAT, built when it is loaded and kept up
+     * to date by fat_put(), so that allocation never scans the FAT. */
+    struct bitmap *used;  /* Clusters in use, one bit per FAT entry. */
+    struct bitmap *dirty; /* FAT sectors changed since they were written. */
+    size_t free_cnt;      /* Number of free clusters. */
+    size_t reserved_cnt;  /* Free clusters promised by fat_reserve(). */
 };
 
 static struct fat_fs *fat_fs;
 
 void fat_boot_create(void);
 void fat_fs_init(void);
+static void fat_index_init(void);
+static void fat_set(cluster_t clst, cluster_t val);
 
 void fat_init(void)
 {
@@ -80,6 +93,7 @@ void fat_open(void)
             free(bounce);
         }
     }
+    fat_index_init();
 }
 
 void fat_close(void)
@@ -92,29 +106,37 @@ void fat_close(void)
     disk_write(filesys_disk, FAT_BOOT_SECTOR, bounce);
     free(bounce);
 
-    // Write FAT directly to the disk
+    // Write back the FAT sectors that changed, in runs of consecutive
+    // sectors.  Only the last sector can be partly past the FAT's end.
     uint8_t *buffer = (uint8_t *)fat_fs->fat;
-    off_t bytes_wrote = 0;
-    off_t bytes_left = sizeof(fat_fs->fat);
-    const off_t fat_size_in_bytes = fat_fs->fat_length * sizeof(cluster_t);
-    for (unsigned i = 0; i < fat_fs->bs.fat_sectors; i++)
+    const size_t fat_size_in_bytes = fat_fs->fat_length * sizeof(cluster_t);
+    size_t i = 0;
+    while ((i = bitmap_scan(fat_fs->dirty, i, 1, true)) != BITMAP_ERROR)
     {
-        bytes_left = fat_size_in_bytes - bytes_wrote;
-        if (bytes_left >= DISK_SECTOR_SIZE)
-        {
-            disk_write(filesys_disk, fat_fs->bs.fat_start + i, buffer + bytes_wrote);
-            bytes_wrote += DISK_SECTOR_SIZE;
-        } else
+        size_t cnt = 1;
+        while (i + cnt < bitmap_size(fat_fs->dirty) && bitmap_test(fat_fs->dirty, i + cnt) &&
+               cnt < DISK_MAX_TRANSFER)
+            cnt++;
+        bitmap_set_multiple(fat_fs->dirty, i, cnt, false);
+        if ((i + cnt) * DISK_SECTOR_SIZE > fat_size_in_bytes)
         {
+            size_t last = i + --cnt;
             bounce = calloc(1, DISK_SECTOR_SIZE);
             if (bounce == NULL)
                 PANIC("FAT close failed");
-            memcpy(bounce, buffer + bytes_wrote, bytes_left);
-            disk_write(filesys_disk, fat_fs->bs.fat_start + i, bounce);
-            bytes_wrote += bytes_left;
+            memcpy(bounce, buffer + last * DISK_SECTOR_SIZE, fat_size_in_bytes - last * DISK_SECTOR_SIZE);
+            disk_write(filesys_disk, fat_fs->bs.fat_start + last, bounce);
             free(bounce);
         }
+        if (cnt > 0)
+            disk_write_multiple(filesys_disk, fat_fs->bs.fat_start + i, cnt, buffer + i * DISK_SECTOR_SIZE);
+        i += cnt;
     }
+
+    free(fat_fs->fat);
+    bitmap_destroy(fat_fs->used);
+    bitmap_destroy(fat_fs->dirty);
+    fat_fs->fat = NULL;
 }
 
 void fat_create(void)
@@ -127,6 +149,8 @@ void fat_create(void)
     fat_fs->fat = calloc(fat_fs->fat_length, sizeof(cluster_t));
     if (fat_fs->fat == NULL)
         PANIC("FAT creation failed");
+    fat_index_init();
+    bitmap_set_all(fat_fs->dirty, true);
 
     // Set up ROOT_DIR_CLST
     fat_put(ROOT_DIR_CLUSTER, EOChain);
@@ -155,7 +179,37 @@ void fat_boot_create(void)
 
 void fat_fs_init(void)
 {
-    /* TODO: Your code goes here. */
+    size_t data_sectors;
+
+    fat_fs->data_start = fat_fs->bs.fat_start + fat_fs->bs.fat_sectors;
+    data_sectors = fat_fs->bs.total_sectors - fat_fs->data_start;
+
+    /* Entry 0 is unused, since a cluster of 0 means none. */
+    fat_fs->fat_length = data_sectors / SECTORS_PER_CLUSTER + 1;
+    if (fat_fs->fat_length > fat_fs->bs.fat_sectors * FAT_PER_SECTOR)
+        fat_fs->fat_length = fat_fs->bs.fat_sectors * FAT_PER_SECTOR;
+    fat_fs->last_clst = ROOT_DIR_CLUSTER;
+    lock_init(&fat_fs->write_lock);
+}
+
+/* Builds the index of the FAT that was just loaded or created. */
+static void fat_index_init(void)
+{
+    cluster_t clst;
+
+    fat_fs->used = bitmap_create(fat_fs->fat_length);
+    fat_fs->dirty = bitmap_create(fat_fs->bs.fat_sectors);
+    if (fat_fs->used == NULL || fat_fs->dirty == NULL)
+        PANIC("FAT index creation failed");
+
+    bitmap_mark(fat_fs->used, 0);
+    fat_fs->free_cnt = 0;
+    for (clst = 1; clst < fat_fs->fat_length; clst++)
+        if (fat_fs->fat[clst] != 0)
+            bitmap_mark(fat_fs->used, clst);
+        else
+            fat_fs->free_cnt++;
+    fat_fs->reserved_cnt = 0;
 }
 
 /*----------------------------------------------------------------------------*/
@@ -167,30 +221,116 @@ void fat_fs_init(void)
  * Returns 0 if fails to allocate a new cluster. */
 cluster_t fat_create_chain(cluster_t clst)
 {
-    /* TODO: Your code goes here. */
+    cluster_t new_clst = BITMAP_ERROR;
+
+    lock_acquire(&fat_fs->write_lock);
+    if (fat_fs->free_cnt > fat_fs->reserved_cnt)
+    {
+        /* Extend a chain into the cluster right after its end if that
+         * is free; start a new one where the last allocation left
+         * off. */
+        cluster_t hint = clst != 0 ? clst + 1 : fat_fs->last_clst;
+        if (hint < fat_fs->fat_length)
+            new_clst = bitmap_scan(fat_fs->used, hint, 1, false);
+        if (new_clst == BITMAP_ERROR)
+            new_clst = bitmap_scan(fat_fs->used, 1, 1, false);
+    }
+    if (new_clst != BITMAP_ERROR)
+    {
+        fat_set(new_clst, EOChain);
+        if (clst != 0)
+            fat_set(clst, new_clst);
+        fat_fs->last_clst = new_clst;
+    } else
+        new_clst = 0;
+    lock_release(&fat_fs->write_lock);
+    return new_clst;
 }
 
 /* Remove the chain of clusters starting from CLST.
  * If PCLST is 0, assume CLST as the start of the chain. */
 void fat_remove_chain(cluster_t clst, cluster_t pclst)
 {
-    /* TODO: Your code goes here. */
+    lock_acquire(&fat_fs->write_lock);
+    if (pclst != 0)
+        fat_set(pclst, EOChain);
+    while (clst != EOChain)
+    {
+        cluster_t next = fat_fs->fat[clst];
+        fat_set(clst, 0);
+        clst = next;
+    }
+    lock_release(&fat_fs->write_lock);
+}
+
+/* Sets aside CNT free clusters, to be allocated later, without
+ * choosing which ones.  Returns false if fewer than CNT clusters are
+ * free. */
+bool fat_reserve(size_t cnt)
+{
+    bool success;
+
+    lock_acquire(&fat_fs->write_lock);
+    success = cnt <= fat_fs->free_cnt - fat_fs->reserved_cnt;
+    if (success)
+        fat_fs->reserved_cnt += cnt;
+    lock_release(&fat_fs->write_lock);
+    return success;
+}
+
+/* Returns CNT clusters set aside by fat_reserve(), so that they may
+ * be allocated. */
+void fat_unreserve(size_t cnt)
+{
+    lock_acquire(&fat_fs->write_lock);
+    ASSERT(cnt <= fat_fs->reserved_cnt);
+    fat_fs->reserved_cnt -= cnt;
+    lock_release(&fat_fs->write_lock);
+}
+
+/* Sets FAT entry CLST to VAL, keeping the index up to date.  The
+ * caller must hold the write lock. */
+static void fat_set(cluster_t clst, cluster_t val)
+{
+    ASSERT(clst != 0 && clst < fat_fs->fat_length);
+
+    if ((fat_fs->fat[clst] == 0) != (val == 0))
+    {
+        bitmap_set(fat_fs->used, clst, val != 0);
+        if (val != 0)
+            fat_fs->free_cnt--;
+        else
+            fat_fs->free_cnt++;
+    }
+    fat_fs->fat[clst] = val;
+    bitmap_mark(fat_fs->dirty, clst / FAT_PER_SECTOR);
 }
 
 /* Update a value in the FAT table. */
 void fat_put(cluster_t clst, cluster_t val)
 {
-    /* TODO: Your code goes here. */
+    lock_acquire(&fat_fs->write_lock);
+    fat_set(clst, val);
+    lock_release(&fat_fs->write_lock);
 }
 
 /* Fetch a value in the FAT table. */
 cluster_t fat_get(cluster_t clst)
 {
-    /* TODO: Your code goes here. */
+    ASSERT(clst != 0 && clst < fat_fs->fat_length);
+    return fat_fs->fat[clst];
 }
 
 /* Covert a cluster # to a sector number. */
 disk_sector_t cluster_to_sector(cluster_t clst)
 {
-    /* TODO: Your code goes here. */
+    ASSERT(clst != 0 && clst < fat_fs->fat_length);
+    return fat_fs->data_start + (clst - 1) * SECTORS_PER_CLUSTER;
+}
+
+/* Converts SECTOR, the first sector of a cluster, to its cluster #. */
+cluster_t sector_to_cluster(disk_sector_t sector)
+{
+    ASSERT(sector >= fat_fs->data_start);
+    return (sector - fat_fs->data_start) / SECTORS_PER_CLUSTER + 1;
 }
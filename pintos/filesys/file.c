@@ -1,13 +1,23 @@
 #include "filesys/file.h"
 #include <debug.h>
+#include "devices/disk.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
 
+/* Read-ahead window, in sectors.  It opens at RA_MIN_SECTORS on a
+ * sequential read and doubles with each one after, up to
+ * RA_MAX_SECTORS. */
+#define RA_MIN_SECTORS 2
+#define RA_MAX_SECTORS 16
+
 /* An open file. */
 struct file {
     struct inode *inode; /* File's inode. */
     off_t pos;           /* Current position. */
     bool deny_write;     /* Has file_deny_write() been called? -> 열려있는 파일일떄 false*/
+    off_t ra_pos;        /* Where a sequential read would start next. */
+    int ra_window;       /* Sectors to read ahead, or 0 after a seek. */
+    off_t ra_end;        /* End of the data read ahead so far. */
 };
 
 /* Opens a file for the given INODE, of which it takes ownership,
@@ -76,7 +86,35 @@ struct inode *file_get_inode(struct file *file)
 off_t file_read(struct file *file, void *buffer, off_t size)
 {
     off_t bytes_read = inode_read_at(file->inode, buffer, size, file->pos);
+
+    /* Read ahead of a reader that picks up where it left off. */
+    if (file->pos == file->ra_pos)
+    {
+        file->ra_window *= 2;
+        if (file->ra_window < RA_MIN_SECTORS)
+            file->ra_window = RA_MIN_SECTORS;
+        if (file->ra_window > RA_MAX_SECTORS)
+            file->ra_window = RA_MAX_SECTORS;
+    } else
+    {
+        file->ra_window = 0;
+        file->ra_end = 0;
+    }
+
     file->pos += bytes_read;
+    file->ra_pos = file->pos;
+    if (file->ra_window > 0 && bytes_read > 0)
+    {
+        /* Only ask for what earlier reads have not asked for yet. */
+        off_t start = file->ra_end > file->pos ? file->ra_end : file->pos;
+        off_t end = file->pos + file->ra_window * DISK_SECTOR_SIZE;
+
+        if (start < end)
+        {
+            inode_readahead(file->inode, end - start, start);
+            file->ra_end = end;
+        }
+    }
     return bytes_read;
 }
 
@@ -93,9 +131,8 @@ off_t file_read_at(struct file *file, void *buffer, off_t size, off_t file_ofs)
 /* Writes SIZE bytes from BUFFER into FILE,
  * starting at the file's current position.
  * Returns the number of bytes actually written,
- * which may be less than SIZE if end of file is reached.
- * (Normally we'd grow the file in that case, but file growth is
- * not yet implemented.)
+ * which may be less than SIZE if the disk is full.
+ * Writing past the end of the file grows it.
  * Advances FILE's position by the number of bytes read. */
 off_t file_write(struct file *file, const void *buffer, off_t size)
 {
@@ -107,9 +144,8 @@ off_t file_write(struct file *file, const void *buffer, off_t size)
 /* Writes SIZE bytes from BUFFER into FILE,
  * starting at offset FILE_OFS in the file.
  * Returns the number of bytes actually written,
- * which may be less than SIZE if end of file is reached.
- * (Normally we'd grow the file in that case, but file growth is
- * not yet implemented.)
+ * which may be less than SIZE if the disk is full.
+ * Writing past the end of the file grows it.
  * The file's current position is unaffected. */
 off_t file_write_at(struct file *file, const void *buffer, off_t size, off_t file_ofs)
 {
@@ -2,6 +2,7 @@
 #include <debug.h>
 #include <stdio.h>
 #include <string.h>
+#include "filesys/buffer_cache.h"
 #include "filesys/file.h"
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
@@ -11,7 +12,12 @@
 /* The disk that contains the file system. */
 struct disk *filesys_disk;
 
+/* Serializes file system operations. */
+struct lock filesys_lock;
+
 static void do_format(void);
+static bool inode_sector_allocate(disk_sector_t *);
+static void inode_sector_release(disk_sector_t);
 
 /* Initializes the file system module.
  * If FORMAT is true, reformats the file system. */
@@ -20,8 +26,11 @@ void filesys_init(bool format)
     filesys_disk = disk_get(0, 1);
     if (filesys_disk == NULL)
         PANIC("hd0:1 (hdb) not present, file system initialization failed");
+    lock_init(&filesys_lock);
 
     inode_init();
+    dir_init();
+    buffer_cache_init();
 
 #ifdef EFILESYS
     fat_init();
@@ -45,12 +54,15 @@ void filesys_init(bool format)
  * to disk. */
 void filesys_done(void)
 {
+    inode_flush();
+
     /* Original FS */
 #ifdef EFILESYS
     fat_close();
 #else
     free_map_close();
 #endif
+    buffer_cache_flush();
 }
 
 /* Creates a file named NAME with the given INITIAL_SIZE.
@@ -61,10 +73,10 @@ bool filesys_create(const char *name, off_t initial_size)
 {
     disk_sector_t inode_sector = 0;
     struct dir *dir = dir_open_root();
-    bool success = (dir != NULL && free_map_allocate(1, &inode_sector) && inode_create(inode_sector, initial_size) &&
+    bool success = (dir != NULL && inode_sector_allocate(&inode_sector) && inode_create(inode_sector, initial_size) &&
                     dir_add(dir, name, inode_sector));
     if (!success && inode_sector != 0)
-        free_map_release(inode_sector, 1);
+        inode_sector_release(inode_sector);
     dir_close(dir);
 
     return success;
@@ -108,6 +120,8 @@ static void do_format(void)
 #ifdef EFILESYS
     /* Create FAT and save it to the disk. */
     fat_create();
+    if (!dir_create(ROOT_DIR_SECTOR, 16))
+        PANIC("root directory creation failed");
     fat_close();
 #else
     free_map_create();
@@ -118,3 +132,27 @@ static void do_format(void)
 
     printf("done.\n");
 }
+
+/* Allocates a sector for a new inode and stores it into *SECTORP.
+ * Returns false if the disk is full. */
+static bool inode_sector_allocate(disk_sector_t *sectorp)
+{
+#ifdef EFILESYS
+    cluster_t clst = fat_create_chain(0);
+    if (clst != 0)
+        *sectorp = cluster_to_sector(clst);
+    return clst != 0;
+#else
+    return free_map_allocate(1, sectorp);
+#endif
+}
+
+/* Releases SECTOR, allocated by inode_sector_allocate(). */
+static void inode_sector_release(disk_sector_t sector)
+{
+#ifdef EFILESYS
+    fat_remove_chain(sector_to_cluster(sector), 0);
+#else
+    free_map_release(sector, 1);
+#endif
+}
@@ -7,6 +7,8 @@
 
 static struct file *free_map_file; /* Free map file. */
 static struct bitmap *free_map;    /* Free map, one bit per disk sector. */
+static size_t free_cnt;            /* Number of free sectors. */
+static size_t reserved_cnt;        /* Free sectors promised by free_map_reserve(). */
 
 /* Initializes the free map. */
 void free_map_init(void)
@@ -16,22 +18,31 @@ void free_map_init(void)
         PANIC("bitmap creation failed--disk is too large");
     bitmap_mark(free_map, FREE_MAP_SECTOR);
     bitmap_mark(free_map, ROOT_DIR_SECTOR);
+    free_cnt = bitmap_size(free_map) - 2;
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
- * the first into *SECTORP.
+ * the first into *SECTORP.  Sectors reserved by free_map_reserve()
+ * are not available.
  * Returns true if successful, false if all sectors were
  * available. */
 bool free_map_allocate(size_t cnt, disk_sector_t *sectorp)
 {
-    disk_sector_t sector = bitmap_scan_and_flip(free_map, 0, cnt, false);
+    disk_sector_t sector;
+
+    if (cnt > free_cnt - reserved_cnt)
+        return false;
+    sector = bitmap_scan_and_flip(free_map, 0, cnt, false);
     if (sector != BITMAP_ERROR && free_map_file != NULL && !bitmap_write(free_map, free_map_file))
     {
         bitmap_set_multiple(free_map, sector, cnt, false);
         sector = BITMAP_ERROR;
     }
     if (sector != BITMAP_ERROR)
+    {
+        free_cnt -= cnt;
         *sectorp = sector;
+    }
     return sector != BITMAP_ERROR;
 }
 
@@ -40,9 +51,29 @@ void free_map_release(disk_sector_t sector, size_t cnt)
 {
     ASSERT(bitmap_all(free_map, sector, cnt));
     bitmap_set_multiple(free_map, sector, cnt, false);
+    free_cnt += cnt;
     bitmap_write(free_map, free_map_file);
 }
 
+/* Sets aside CNT free sectors, to be allocated later, without
+ * choosing which ones.  Returns false if fewer than CNT sectors are
+ * free. */
+bool free_map_reserve(size_t cnt)
+{
+    if (cnt > free_cnt - reserved_cnt)
+        return false;
+    reserved_cnt += cnt;
+    return true;
+}
+
+/* Returns CNT sectors set aside by free_map_reserve(), so that they
+ * may be allocated. */
+void free_map_unreserve(size_t cnt)
+{
+    ASSERT(cnt <= reserved_cnt);
+    reserved_cnt -= cnt;
+}
+
 /* Opens the free map file and reads it from disk. */
 void free_map_open(void)
 {
@@ -51,6 +82,7 @@ void free_map_open(void)
         PANIC("can't open free map");
     if (!bitmap_read(free_map, free_map_file))
         PANIC("can't read free map");
+    free_cnt = bitmap_count(free_map, 0, bitmap_size(free_map), false);
 }
 
 /* Writes the free map to disk and closes the free map file. */
@@ -1,24 +1,107 @@
 #include "filesys/inode.h"
+#include <hash.h>
 #include <list.h>
 #include <debug.h>
 #include <round.h>
 #include <string.h>
+#include "filesys/buffer_cache.h"
 #include "filesys/filesys.h"
+#ifdef EFILESYS
+#include "filesys/fat.h"
+#else
 #include "filesys/free-map.h"
+#endif
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
-/* On-disk inode.
+/* Allocation is delayed: a sector written past the end of an inode's
+ * placed data, or into a hole, stays in memory, with space reserved
+ * for it, until the inode is closed or has DELALLOC_MAX such sectors.
+ * Then they are all placed at once, so that a file written in small
+ * pieces, or side by side with another one, still ends up in a few
+ * long runs. */
+#define DELALLOC_MAX 64
+
+#ifdef EFILESYS
+/* On-disk inode.  Its data is a chain of clusters in the FAT.
  * Must be exactly DISK_SECTOR_SIZE bytes long. */
 struct inode_disk {
-    disk_sector_t start;  /* First data sector. */
+    cluster_t start;      /* First data cluster, or 0 if none. */
     off_t length;         /* File size in bytes. */
     unsigned magic;       /* Magic number. */
     uint32_t unused[125]; /* Not used. */
 };
 
+/* Seek cache.  Walking a chain from its start to reach a sector makes
+ * random access quadratic, so each inode remembers the cluster of
+ * every SEEK_STRIDE'th sector it has walked past, in SEEK_SLOTS
+ * direct-mapped slots, as well as the last sector it sought.  A seek
+ * then walks at most SEEK_STRIDE - 1 clusters once the chain around
+ * its target has been seen. */
+#define SEEK_STRIDE 16
+#define SEEK_SLOTS 32
+
+/* Sector IDX of a file is in cluster CLST, or CLST is 0. */
+struct seek_point {
+    size_t idx;
+    cluster_t clst;
+};
+#elif defined INODE_INDEXED
+/* Block index, the layout that extents replaced, kept as a build
+ * option.  An inode's data sectors are found through DIRECT_CNT direct
+ * pointers, then one indirect block of INDIRECT_CNT pointers, then one
+ * doubly indirect block of pointers to indirect blocks.  A pointer of
+ * 0 means no sector, so a file may have holes, which read as zeros. */
+#define DIRECT_CNT 124
+#define INDIRECT_CNT (DISK_SECTOR_SIZE / sizeof(disk_sector_t))
+#define MAX_SECTORS (DIRECT_CNT + INDIRECT_CNT + INDIRECT_CNT * INDIRECT_CNT)
+
+/* On-disk inode.
+ * Must be exactly DISK_SECTOR_SIZE bytes long. */
+struct inode_disk {
+    off_t length;                     /* File size in bytes. */
+    unsigned magic;                   /* Magic number. */
+    disk_sector_t direct[DIRECT_CNT]; /* Data sectors. */
+    disk_sector_t indirect;           /* Block of data sectors. */
+    disk_sector_t doubly_indirect;    /* Block of indirect blocks. */
+};
+#else
+/* A run of LENGTH consecutive sectors starting at START, or a hole of
+ * LENGTH sectors that reads as zeros if START is 0.  Sector 0 holds
+ * the free map's inode, so it is never file data. */
+struct extent {
+    disk_sector_t start;
+    uint32_t length;
+};
+
+/* Extent list.  An inode's data is the concatenation of its extents,
+ * the first INLINE_EXTENTS of them in the inode itself and the rest in
+ * a chain of overflow blocks, as long as the list needs. */
+#define INLINE_EXTENTS 62
+#define OVERFLOW_EXTENTS 63
+
+/* On-disk inode.
+ * Must be exactly DISK_SECTOR_SIZE bytes long. */
+struct inode_disk {
+    off_t length;                          /* File size in bytes. */
+    unsigned magic;                        /* Magic number. */
+    uint32_t extent_cnt;                   /* Number of extents. */
+    disk_sector_t overflow;                /* First overflow block, or 0. */
+    struct extent extents[INLINE_EXTENTS]; /* Data sectors. */
+};
+
+/* Overflow block of an extent list.
+ * Must be exactly DISK_SECTOR_SIZE bytes long. */
+struct overflow_block {
+    disk_sector_t next;                      /* Next overflow block, or 0. */
+    uint32_t unused;                         /* Not used. */
+    struct extent extents[OVERFLOW_EXTENTS]; /* Further extents. */
+};
+#endif
+
 /* Returns the number of sectors to allocate for an inode SIZE
  * bytes long. */
 static inline size_t bytes_to_sectors(off_t size)
@@ -26,37 +109,862 @@ static inline size_t bytes_to_sectors(off_t size)
     return DIV_ROUND_UP(size, DISK_SECTOR_SIZE);
 }
 
+/* Key of an inode in the inode table. */
+struct inode_key {
+    struct hash_elem elem; /* Element in inodes. */
+    disk_sector_t sector;  /* Sector number of disk location. */
+};
+
 /* In-memory inode. */
 struct inode {
-    struct list_elem elem;  /* Element in inode list. */
-    disk_sector_t sector;   /* Sector number of disk location. */
+    struct inode_key key;   /* Element in inodes, keyed by sector. */
+    struct list_elem elem;  /* Element in closed_inodes, if closed. */
     int open_cnt;           /* Number of openers. */
     bool removed;           /* True if deleted, false otherwise. */
     int deny_write_cnt;     /* 0: writes ok, >0: deny writes. */
+    struct lock lock;       /* Protects the members below. */
     struct inode_disk data; /* Inode content. */
+    size_t placed;          /* Sectors of data placed on disk. */
+    struct list pending;    /* Written sectors not yet placed. */
+    size_t pending_cnt;     /* Number of elements in PENDING. */
+    size_t reserved;        /* Sectors reserved for placing PENDING. */
+#ifdef EFILESYS
+    struct seek_point seek_last;               /* Last sector sought. */
+    struct seek_point seek_points[SEEK_SLOTS]; /* Seek cache. */
+#elif !defined INODE_INDEXED
+    struct extent *extents;     /* All DATA.EXTENT_CNT extents. */
+    size_t extent_cap;          /* Number of extents EXTENTS has room for. */
+    disk_sector_t *overflow;    /* Overflow blocks, in chain order. */
+    size_t overflow_cnt;        /* Number of overflow blocks. */
+    size_t overflow_cap;        /* Number of blocks OVERFLOW has room for. */
+    size_t overflow_reserved;   /* Further overflow blocks in RESERVED. */
+    size_t hint_i, hint_base;   /* Extent found last, and its first sector. */
+#endif
 };
 
+/* A sector of file data written before it was placed on disk. */
+struct pending_sector {
+    struct list_elem elem;          /* Element in inode's PENDING list. */
+    size_t idx;                     /* Index of the sector in the file. */
+    uint8_t data[DISK_SECTOR_SIZE]; /* Contents. */
+};
+
+/* Returns the unplaced sector IDX of INODE, or a null pointer if
+ * there is none. */
+static struct pending_sector *pending_find(struct inode *inode, size_t idx)
+{
+    struct list_elem *e;
+
+    for (e = list_begin(&inode->pending); e != list_end(&inode->pending); e = list_next(e))
+    {
+        struct pending_sector *p = list_entry(e, struct pending_sector, elem);
+        if (p->idx == idx)
+            return p;
+    }
+    return NULL;
+}
+
+/* Adds a zeroed unplaced sector IDX to INODE and returns it, or a
+ * null pointer if memory runs out. */
+static struct pending_sector *pending_add(struct inode *inode, size_t idx)
+{
+    struct pending_sector *p = calloc(1, sizeof *p);
+
+    if (p == NULL)
+        return NULL;
+    p->idx = idx;
+    list_push_back(&inode->pending, &p->elem);
+    inode->pending_cnt++;
+    return p;
+}
+
+/* Frees the unplaced sectors of INODE. */
+static void pending_clear(struct inode *inode)
+{
+    while (!list_empty(&inode->pending))
+        free(list_entry(list_pop_front(&inode->pending), struct pending_sector, elem));
+    inode->pending_cnt = 0;
+}
+
+/* Writes sector IDX of INODE, which was just placed at SECTOR, from
+ * its unplaced copy, or zeroes it. */
+static void sector_fill(struct inode *inode, size_t idx, disk_sector_t sector)
+{
+    static uint8_t zeros[DISK_SECTOR_SIZE];
+    struct pending_sector *p = pending_find(inode, idx);
+
+    buffer_cache_write(sector, p != NULL ? p->data : zeros, 0, DISK_SECTOR_SIZE);
+}
+
+#ifdef EFILESYS
+/* Reserves the sectors that growing INODE to LENGTH bytes adds, all
+ * of which are placed later.  Returns false if the disk does not have
+ * that many free. */
+static bool space_grow(struct inode *inode, off_t length)
+{
+    size_t cnt = bytes_to_sectors(length) - bytes_to_sectors(inode->data.length);
+
+    if (!fat_reserve(cnt))
+        return false;
+    inode->reserved += cnt;
+    return true;
+}
+
+/* Reserves room for one more unplaced sector of INODE.  Every sector
+ * past the placed data was reserved when the file grew, so this takes
+ * nothing more. */
+static bool space_pending(struct inode *inode UNUSED)
+{
+    return true;
+}
+
+/* Returns CNT reserved sectors. */
+static void space_unreserve(size_t cnt)
+{
+    fat_unreserve(cnt);
+}
+
+/* Releases the sector of a removed inode. */
+static void space_release(disk_sector_t sector)
+{
+    fat_remove_chain(sector_to_cluster(sector), 0);
+}
+
+/* Returns the cluster that holds sector IDX of INODE, which must have
+ * been placed.  Walks the chain from the closest position before IDX
+ * that the seek cache knows. */
+static cluster_t chain_seek(struct inode *inode, size_t idx)
+{
+    struct seek_point *sp = &inode->seek_points[idx / SEEK_STRIDE % SEEK_SLOTS];
+    struct seek_point pos = {0, inode->data.start};
+
+    if (inode->seek_last.clst != 0 && inode->seek_last.idx <= idx)
+        pos = inode->seek_last;
+    if (sp->clst != 0 && sp->idx / SEEK_STRIDE == idx / SEEK_STRIDE && sp->idx > pos.idx)
+        pos = *sp;
+
+    while (pos.idx < idx)
+    {
+        pos.clst = fat_get(pos.clst);
+        if (++pos.idx % SEEK_STRIDE == 0)
+            inode->seek_points[pos.idx / SEEK_STRIDE % SEEK_SLOTS] = pos;
+    }
+    inode->seek_last = pos;
+    return pos.clst;
+}
+
+/* Places CNT sectors after the placed data of INODE, by extending its
+ * cluster chain.  A cluster holds a single sector.  Returns the number
+ * of sectors placed, which is less than CNT if the disk fills up. */
+static size_t data_alloc(struct inode *inode, size_t cnt)
+{
+    cluster_t clst = inode->placed > 0 ? chain_seek(inode, inode->placed - 1) : 0;
+    size_t done;
+
+    for (done = 0; done < cnt; done++)
+    {
+        cluster_t next = fat_create_chain(clst);
+        if (next == 0)
+            break;
+        if (inode->data.start == 0)
+            inode->data.start = next;
+        clst = next;
+        sector_fill(inode, inode->placed + done, cluster_to_sector(clst));
+    }
+
+    /* The next placement continues from the new tail. */
+    if (done > 0)
+        inode->seek_last = (struct seek_point){inode->placed + done - 1, clst};
+    return done;
+}
+
+/* Places the CNT sectors of a new INODE.  Returns false if the disk
+ * fills up first. */
+static bool data_create(struct inode *inode, size_t cnt)
+{
+    return data_alloc(inode, cnt) == cnt;
+}
+
+/* Places the unplaced sectors of INODE, for which room was reserved. */
+static void data_place(struct inode *inode)
+{
+    size_t cnt = bytes_to_sectors(inode->data.length) - inode->placed;
+    size_t done = data_alloc(inode, cnt);
+
+    ASSERT(done == cnt);
+    inode->placed += cnt;
+}
+
+/* Releases every data sector of INODE. */
+static void data_release(struct inode *inode)
+{
+    if (inode->data.start != 0)
+        fat_remove_chain(inode->data.start, 0);
+}
+
+/* Sets up what INODE keeps in memory about its data, once the inode
+ * itself has been read.  Returns false if memory runs out. */
+static bool data_load(struct inode *inode)
+{
+    inode->seek_last.clst = 0;
+    memset(inode->seek_points, 0, sizeof inode->seek_points);
+    return true;
+}
+
+/* Frees what INODE keeps in memory about its data. */
+static void data_free(struct inode *inode UNUSED)
+{
+}
+
+/* Writes INODE to disk. */
+static void inode_sync(struct inode *inode)
+{
+    buffer_cache_write(inode->key.sector, &inode->data, 0, DISK_SECTOR_SIZE);
+}
+
 /* Returns the disk sector that contains byte offset POS within
- * INODE.
- * Returns -1 if INODE does not contain data for a byte at offset
- * POS. */
-static disk_sector_t byte_to_sector(const struct inode *inode, off_t pos)
+ * INODE, or 0 if that sector has not been placed yet. */
+static disk_sector_t byte_to_sector(struct inode *inode, off_t pos)
 {
+    size_t idx = pos / DISK_SECTOR_SIZE;
+
     ASSERT(inode != NULL);
-    if (pos < inode->data.length)
-        return inode->data.start + pos / DISK_SECTOR_SIZE;
+    if (idx >= inode->placed)
+        return 0;
+    return cluster_to_sector(chain_seek(inode, idx));
+}
+#elif defined INODE_INDEXED
+/* Reserves the sectors that growing INODE to LENGTH bytes adds.  The
+ * new end of the file is a hole until it is written, so this takes
+ * nothing, but the index must be able to describe it.  Returns false
+ * if LENGTH is too long for that. */
+static bool space_grow(struct inode *inode UNUSED, off_t length)
+{
+    return bytes_to_sectors(length) <= MAX_SECTORS;
+}
+
+/* Reserves room for one more unplaced sector of INODE: the sector
+ * itself, and the at most two index blocks that placing it can add.
+ * Returns false if the disk is full. */
+static bool space_pending(struct inode *inode)
+{
+    if (!free_map_reserve(3))
+        return false;
+    inode->reserved += 3;
+    return true;
+}
+
+/* Returns CNT reserved sectors. */
+static void space_unreserve(size_t cnt)
+{
+    free_map_unreserve(cnt);
+}
+
+/* Releases the sector of a removed inode. */
+static void space_release(disk_sector_t sector)
+{
+    free_map_release(sector, 1);
+}
+
+/* Returns pointer SLOT of index block BLOCK. */
+static disk_sector_t index_get(disk_sector_t block, size_t slot)
+{
+    disk_sector_t sector;
+
+    buffer_cache_read(block, &sector, slot * sizeof sector, sizeof sector);
+    return sector;
+}
+
+/* Sets pointer SLOT of index block BLOCK to SECTOR. */
+static void index_set(disk_sector_t block, size_t slot, disk_sector_t sector)
+{
+    buffer_cache_write(block, &sector, slot * sizeof sector, sizeof sector);
+}
+
+/* Allocates a zeroed index block and returns it, or 0 if the disk is
+ * full. */
+static disk_sector_t index_alloc(void)
+{
+    static uint8_t zeros[DISK_SECTOR_SIZE];
+    disk_sector_t sector;
+
+    if (!free_map_allocate(1, &sector))
+        return 0;
+    buffer_cache_write(sector, zeros, 0, DISK_SECTOR_SIZE);
+    return sector;
+}
+
+/* Returns the index block that *POINTER names.  If it is 0 and CREATE
+ * is true, allocates one first.  Returns 0 if there is none. */
+static disk_sector_t pointer_get(disk_sector_t *pointer, bool create)
+{
+    if (*pointer == 0 && create)
+        *pointer = index_alloc();
+    return *pointer;
+}
+
+/* Returns the index block that pointer SLOT of index block BLOCK
+ * names.  If it is 0 and CREATE is true, allocates one first.  Returns
+ * 0 if there is none. */
+static disk_sector_t index_child(disk_sector_t block, size_t slot, bool create)
+{
+    disk_sector_t child = index_get(block, slot);
+
+    if (child == 0 && create && (child = index_alloc()) != 0)
+        index_set(block, slot, child);
+    return child;
+}
+
+/* Finds the pointer to data sector IDX of DISK: pointer *SLOT of index
+ * block *BLOCK, or of DISK's direct pointers if *BLOCK is 0.  If
+ * CREATE is true, allocates the index blocks on the way that are
+ * missing.  Returns false if one is missing all the same. */
+static bool index_find(struct inode_disk *disk, size_t idx, bool create, disk_sector_t *block, size_t *slot)
+{
+    if (idx < DIRECT_CNT)
+    {
+        *block = 0;
+        *slot = idx;
+        return true;
+    }
+    idx -= DIRECT_CNT;
+
+    if (idx < INDIRECT_CNT)
+        *block = pointer_get(&disk->indirect, create);
+    else
+    {
+        idx -= INDIRECT_CNT;
+        ASSERT(idx < INDIRECT_CNT * INDIRECT_CNT);
+        *block = pointer_get(&disk->doubly_indirect, create);
+        if (*block != 0)
+            *block = index_child(*block, idx / INDIRECT_CNT, create);
+        idx %= INDIRECT_CNT;
+    }
+    *slot = idx;
+    return *block != 0;
+}
+
+/* Places sector IDX of INODE, which lies in a hole, and fills it.
+ * Returns false if the disk fills up first. */
+static bool index_place(struct inode *inode, size_t idx)
+{
+    disk_sector_t block, sector;
+    size_t slot;
+
+    if (!index_find(&inode->data, idx, true, &block, &slot) || !free_map_allocate(1, &sector))
+        return false;
+    sector_fill(inode, idx, sector);
+    if (block == 0)
+        inode->data.direct[slot] = sector;
     else
-        return -1;
+        index_set(block, slot, sector);
+    return true;
+}
+
+/* Places the CNT sectors of a new INODE.  Returns false if the disk
+ * fills up first, or the index cannot describe that many. */
+static bool data_create(struct inode *inode, size_t cnt)
+{
+    size_t i;
+
+    if (cnt > MAX_SECTORS)
+        return false;
+    for (i = 0; i < cnt; i++)
+        if (!index_place(inode, i))
+            return false;
+    inode->placed = cnt;
+    return true;
+}
+
+/* Places the unplaced sectors of INODE, for which room was reserved
+ * along with the index blocks they take.  The end of the file past
+ * them is left as a hole. */
+static void data_place(struct inode *inode)
+{
+    struct list_elem *e;
+
+    inode->placed = bytes_to_sectors(inode->data.length);
+    for (e = list_begin(&inode->pending); e != list_end(&inode->pending); e = list_next(e))
+    {
+        bool placed = index_place(inode, list_entry(e, struct pending_sector, elem)->idx);
+        ASSERT(placed);
+    }
+}
+
+/* Releases index block BLOCK and the sectors it points to.  LEVEL is
+ * 1 for an indirect block and 2 for a doubly indirect one. */
+static void index_release(disk_sector_t block, int level)
+{
+    size_t i;
+
+    for (i = 0; i < INDIRECT_CNT; i++)
+    {
+        disk_sector_t sector = index_get(block, i);
+        if (sector == 0)
+            continue;
+        if (level > 1)
+            index_release(sector, level - 1);
+        else
+            free_map_release(sector, 1);
+    }
+    free_map_release(block, 1);
+}
+
+/* Releases every data sector of INODE, and its index blocks. */
+static void data_release(struct inode *inode)
+{
+    struct inode_disk *disk = &inode->data;
+    size_t i;
+
+    for (i = 0; i < DIRECT_CNT; i++)
+        if (disk->direct[i] != 0)
+            free_map_release(disk->direct[i], 1);
+    if (disk->indirect != 0)
+        index_release(disk->indirect, 1);
+    if (disk->doubly_indirect != 0)
+        index_release(disk->doubly_indirect, 2);
+}
+
+/* Sets up what INODE keeps in memory about its data, once the inode
+ * itself has been read.  The index is read as it is used, so this
+ * takes nothing. */
+static bool data_load(struct inode *inode UNUSED)
+{
+    return true;
+}
+
+/* Frees what INODE keeps in memory about its data. */
+static void data_free(struct inode *inode UNUSED)
+{
+}
+
+/* Writes INODE to disk.  Its index blocks are written as they
+ * change. */
+static void inode_sync(struct inode *inode)
+{
+    buffer_cache_write(inode->key.sector, &inode->data, 0, DISK_SECTOR_SIZE);
+}
+
+/* Returns the disk sector that contains byte offset POS within
+ * INODE, or 0 if that sector has not been placed yet or lies in a
+ * hole. */
+static disk_sector_t byte_to_sector(struct inode *inode, off_t pos)
+{
+    size_t idx = pos / DISK_SECTOR_SIZE;
+    disk_sector_t block;
+    size_t slot;
+
+    ASSERT(inode != NULL);
+    if (idx >= inode->placed || !index_find(&inode->data, idx, false, &block, &slot))
+        return 0;
+    return block == 0 ? inode->data.direct[slot] : index_get(block, slot);
+}
+#else
+/* Returns the number of overflow blocks that CNT extents take. */
+static inline size_t overflow_blocks(size_t cnt)
+{
+    return cnt > INLINE_EXTENTS ? DIV_ROUND_UP(cnt - INLINE_EXTENTS, OVERFLOW_EXTENTS) : 0;
 }
 
-/* List of open inodes, so that opening a single inode twice
- * returns the same `struct inode'. */
-static struct list open_inodes;
+/* Makes room in memory for INODE to have CNT extents, and for the
+ * overflow blocks that they take.  Returns false if memory runs
+ * out. */
+static bool extent_room(struct inode *inode, size_t cnt)
+{
+    size_t blocks = overflow_blocks(cnt);
+
+    if (cnt > inode->extent_cap)
+    {
+        size_t cap = cnt > 2 * inode->extent_cap ? cnt : 2 * inode->extent_cap;
+        struct extent *extents = realloc(inode->extents, cap * sizeof *extents);
+        if (extents == NULL)
+            return false;
+        inode->extents = extents;
+        inode->extent_cap = cap;
+    }
+    if (blocks > inode->overflow_cap)
+    {
+        disk_sector_t *overflow = realloc(inode->overflow, blocks * sizeof *overflow);
+        if (overflow == NULL)
+            return false;
+        inode->overflow = overflow;
+        inode->overflow_cap = blocks;
+    }
+    return true;
+}
+
+/* Reserves the sectors that growing INODE to LENGTH bytes adds.  The
+ * new end of the file is a hole until it is written, so this takes
+ * nothing. */
+static bool space_grow(struct inode *inode UNUSED, off_t length UNUSED)
+{
+    return true;
+}
+
+/* Reserves room for one more unplaced sector of INODE: the sector
+ * itself, and memory and overflow blocks for the extents that placing
+ * it can add.  Placing a run of sectors in a hole splits the hole in
+ * two and adds at most one extent per sector, and the end of the file
+ * may become one more hole.  Returns false if the disk or memory is
+ * full. */
+static bool space_pending(struct inode *inode)
+{
+    size_t cnt = inode->data.extent_cnt + 2 * (inode->pending_cnt + 1) + 1;
+    size_t blocks = overflow_blocks(cnt);
+    size_t have = inode->overflow_cnt + inode->overflow_reserved;
+    size_t more = blocks > have ? blocks - have : 0;
+
+    if (!extent_room(inode, cnt) || !free_map_reserve(1 + more))
+        return false;
+    inode->reserved += 1 + more;
+    inode->overflow_reserved += more;
+    return true;
+}
+
+/* Returns CNT reserved sectors. */
+static void space_unreserve(size_t cnt)
+{
+    free_map_unreserve(cnt);
+}
+
+/* Releases the sector of a removed inode. */
+static void space_release(disk_sector_t sector)
+{
+    free_map_release(sector, 1);
+}
+
+/* Returns the index of the extent of INODE that holds sector IDX,
+ * which must have been placed, and stores the index of its first
+ * sector in *BASE.  The search starts at the extent found last unless
+ * that is past IDX, so that sequential access does not rescan the
+ * list. */
+static size_t extent_find(struct inode *inode, size_t idx, size_t *base)
+{
+    size_t i = 0, b = 0;
+
+    if (inode->hint_base <= idx)
+    {
+        i = inode->hint_i;
+        b = inode->hint_base;
+    }
+    while (idx >= b + inode->extents[i].length)
+        b += inode->extents[i++].length;
+    inode->hint_i = i;
+    inode->hint_base = b;
+    *base = b;
+    return i;
+}
+
+/* Removes extent I of INODE. */
+static void extent_remove(struct inode *inode, size_t i)
+{
+    struct extent *e = inode->extents;
+
+    memmove(&e[i], &e[i + 1], (inode->data.extent_cnt - i - 1) * sizeof *e);
+    inode->data.extent_cnt--;
+}
+
+/* Appends a hole of CNT sectors to the extents of INODE, merging it
+ * into the last extent if that is a hole too.  INODE must have room
+ * for one more extent. */
+static void extent_hole(struct inode *inode, size_t cnt)
+{
+    struct extent *last = inode->data.extent_cnt > 0 ? &inode->extents[inode->data.extent_cnt - 1] : NULL;
+
+    if (last != NULL && last->start == 0)
+        last->length += cnt;
+    else
+        inode->extents[inode->data.extent_cnt++] = (struct extent){0, cnt};
+}
+
+/* Maps the LENGTH sectors of INODE starting at IDX, which lie in a
+ * single hole, to the disk sectors starting at START.  The hole is
+ * split around them, and they are merged into the extents beside
+ * them that continue them on disk.  INODE must have room for two more
+ * extents. */
+static void extent_map(struct inode *inode, size_t idx, disk_sector_t start, size_t length)
+{
+    struct extent *e = inode->extents;
+    struct extent pieces[3];
+    size_t base, i = extent_find(inode, idx, &base);
+    size_t before = idx - base, after, cnt = 0, j;
+
+    ASSERT(e[i].start == 0 && idx + length <= base + e[i].length);
+    after = base + e[i].length - idx - length;
+    if (before > 0)
+        pieces[cnt++] = (struct extent){0, before};
+    pieces[cnt++] = (struct extent){start, length};
+    if (after > 0)
+        pieces[cnt++] = (struct extent){0, after};
+
+    memmove(&e[i + cnt], &e[i + 1], (inode->data.extent_cnt - i - 1) * sizeof *e);
+    memcpy(&e[i], pieces, cnt * sizeof *e);
+    inode->data.extent_cnt += cnt - 1;
+
+    j = i + (before > 0);
+    if (j + 1 < inode->data.extent_cnt && e[j + 1].start != 0 && e[j].start + e[j].length == e[j + 1].start)
+    {
+        e[j].length += e[j + 1].length;
+        extent_remove(inode, j + 1);
+    }
+    if (j > 0 && e[j - 1].start != 0 && e[j - 1].start + e[j - 1].length == e[j].start)
+    {
+        e[j - 1].length += e[j].length;
+        extent_remove(inode, j);
+    }
+    inode->hint_i = inode->hint_base = 0;
+}
+
+/* Places the CNT sectors of INODE starting at IDX, which lie in a
+ * single hole, in as few runs as the free map allows, and fills them.
+ * Returns false if the disk or memory fills up first, leaving the
+ * sectors not placed yet in the hole. */
+static bool hole_fill(struct inode *inode, size_t idx, size_t cnt)
+{
+    while (cnt > 0)
+    {
+        size_t run = cnt;
+        disk_sector_t start;
+        size_t i;
+
+        if (!extent_room(inode, inode->data.extent_cnt + 2))
+            return false;
+        while (!free_map_allocate(run, &start))
+            if ((run /= 2) == 0)
+                return false;
+
+        for (i = 0; i < run; i++)
+            sector_fill(inode, idx + i, start + i);
+        extent_map(inode, idx, start, run);
+        idx += run;
+        cnt -= run;
+    }
+    return true;
+}
+
+/* Allocates the overflow blocks that the extents of INODE take beyond
+ * those it has.  Returns false if the disk is full. */
+static bool overflow_alloc(struct inode *inode)
+{
+    size_t blocks = overflow_blocks(inode->data.extent_cnt);
+
+    while (inode->overflow_cnt < blocks)
+    {
+        if (!free_map_allocate(1, &inode->overflow[inode->overflow_cnt]))
+            return false;
+        inode->overflow_cnt++;
+    }
+    return true;
+}
+
+/* Places the CNT sectors of a new INODE.  Returns false if the disk or
+ * memory fills up first. */
+static bool data_create(struct inode *inode, size_t cnt)
+{
+    if (cnt > 0)
+    {
+        if (!extent_room(inode, 1))
+            return false;
+        extent_hole(inode, cnt);
+        inode->placed = cnt;
+    }
+    return hole_fill(inode, 0, cnt) && overflow_alloc(inode);
+}
+
+/* Orders the unplaced sectors A and B by index. */
+static bool pending_less(const struct list_elem *a, const struct list_elem *b, void *aux UNUSED)
+{
+    return list_entry(a, struct pending_sector, elem)->idx < list_entry(b, struct pending_sector, elem)->idx;
+}
+
+/* Places the unplaced sectors of INODE, for which room was reserved
+ * along with the extents they take.  The end of the file past its
+ * extents becomes a hole, and each run of consecutive unplaced
+ * sectors is placed into the hole that it falls in. */
+static void data_place(struct inode *inode)
+{
+    size_t sectors = bytes_to_sectors(inode->data.length);
+    struct list_elem *e;
+    bool placed;
+
+    if (sectors > inode->placed)
+    {
+        extent_hole(inode, sectors - inode->placed);
+        inode->placed = sectors;
+    }
+
+    list_sort(&inode->pending, pending_less, NULL);
+    for (e = list_begin(&inode->pending); e != list_end(&inode->pending);)
+    {
+        size_t idx = list_entry(e, struct pending_sector, elem)->idx;
+        size_t cnt = 0;
+
+        do
+        {
+            e = list_next(e);
+            cnt++;
+        } while (e != list_end(&inode->pending) && list_entry(e, struct pending_sector, elem)->idx == idx + cnt);
+        placed = hole_fill(inode, idx, cnt);
+        ASSERT(placed);
+    }
+    placed = overflow_alloc(inode);
+    ASSERT(placed);
+    inode->overflow_reserved = 0;
+}
+
+/* Releases every data sector of INODE, and its overflow blocks. */
+static void data_release(struct inode *inode)
+{
+    size_t i;
+
+    for (i = 0; i < inode->data.extent_cnt; i++)
+        if (inode->extents[i].start != 0)
+            free_map_release(inode->extents[i].start, inode->extents[i].length);
+    for (i = 0; i < inode->overflow_cnt; i++)
+        free_map_release(inode->overflow[i], 1);
+}
+
+/* Frees what INODE keeps in memory about its data. */
+static void data_free(struct inode *inode)
+{
+    free(inode->extents);
+    free(inode->overflow);
+}
+
+/* Sets up what INODE keeps in memory about its data, once the inode
+ * itself has been read: its whole extent list, read along the chain
+ * of overflow blocks.  Returns false if memory runs out. */
+static bool data_load(struct inode *inode)
+{
+    size_t cnt = inode->data.extent_cnt;
+    disk_sector_t next = inode->data.overflow;
+    size_t i;
+
+    inode->extents = NULL;
+    inode->extent_cap = 0;
+    inode->overflow = NULL;
+    inode->overflow_cnt = inode->overflow_cap = inode->overflow_reserved = 0;
+    inode->hint_i = inode->hint_base = 0;
+    if (!extent_room(inode, cnt))
+    {
+        data_free(inode);
+        return false;
+    }
+
+    memcpy(inode->extents, inode->data.extents, (cnt < INLINE_EXTENTS ? cnt : INLINE_EXTENTS) * sizeof *inode->extents);
+    for (i = INLINE_EXTENTS; i < cnt && next != 0; i += OVERFLOW_EXTENTS)
+    {
+        struct overflow_block block;
+        size_t n = cnt - i < OVERFLOW_EXTENTS ? cnt - i : OVERFLOW_EXTENTS;
+
+        buffer_cache_read(next, &block, 0, DISK_SECTOR_SIZE);
+        inode->overflow[inode->overflow_cnt++] = next;
+        memcpy(inode->extents + i, block.extents, n * sizeof *inode->extents);
+        next = block.next;
+    }
+    return true;
+}
+
+/* Writes INODE to disk, along with its overflow blocks. */
+static void inode_sync(struct inode *inode)
+{
+    struct inode_disk *disk = &inode->data;
+    size_t cnt = disk->extent_cnt;
+    size_t b;
+
+    memcpy(disk->extents, inode->extents, (cnt < INLINE_EXTENTS ? cnt : INLINE_EXTENTS) * sizeof *disk->extents);
+    disk->overflow = inode->overflow_cnt > 0 ? inode->overflow[0] : 0;
+    for (b = 0; b < inode->overflow_cnt; b++)
+    {
+        struct overflow_block block;
+        size_t i = INLINE_EXTENTS + b * OVERFLOW_EXTENTS;
+        size_t n = i >= cnt ? 0 : cnt - i < OVERFLOW_EXTENTS ? cnt - i : OVERFLOW_EXTENTS;
+
+        memset(&block, 0, sizeof block);
+        block.next = b + 1 < inode->overflow_cnt ? inode->overflow[b + 1] : 0;
+        memcpy(block.extents, inode->extents + i, n * sizeof *block.extents);
+        buffer_cache_write(inode->overflow[b], &block, 0, DISK_SECTOR_SIZE);
+    }
+    buffer_cache_write(inode->key.sector, disk, 0, DISK_SECTOR_SIZE);
+}
+
+/* Returns the disk sector that contains byte offset POS within
+ * INODE, or 0 if that sector has not been placed yet or lies in a
+ * hole. */
+static disk_sector_t byte_to_sector(struct inode *inode, off_t pos)
+{
+    size_t idx = pos / DISK_SECTOR_SIZE;
+    struct extent *e;
+    size_t base;
+
+    ASSERT(inode != NULL);
+    if (idx >= inode->placed)
+        return 0;
+    e = &inode->extents[extent_find(inode, idx, &base)];
+    return e->start != 0 ? e->start + (idx - base) : 0;
+}
+#endif
+
+/* Places the unplaced sectors of INODE on disk, then writes out the
+ * inode.  The writes that left them unplaced reserved all the room
+ * this takes, and file system operations are serialized by
+ * filesys_lock, so it cannot fail. */
+static void inode_place(struct inode *inode)
+{
+    space_unreserve(inode->reserved);
+    inode->reserved = 0;
+    data_place(inode);
+    pending_clear(inode);
+    inode_sync(inode);
+}
+
+/* Returns true if INODE has sectors or reservations that have not
+ * been placed yet. */
+static bool inode_unplaced(struct inode *inode)
+{
+    return inode->reserved > 0 || inode->placed < bytes_to_sectors(inode->data.length);
+}
+
+/* Frees INODE, which is no longer in the inode table. */
+static void inode_free(struct inode *inode)
+{
+    data_free(inode);
+    free(inode);
+}
+
+/* Table of open inodes, so that opening a single inode twice
+ * returns the same `struct inode'.  It also holds the
+ * CLOSED_INODE_CNT inodes closed most recently, which are clean, so
+ * that reopening one reads nothing from disk. */
+#define CLOSED_INODE_CNT 16
+static struct hash inodes;
+
+/* Closed inodes in INODES, most recently closed first. */
+static struct list closed_inodes;
+
+/* Protects INODES, CLOSED_INODES, and the open count and REMOVED flag
+ * of every inode.  Taken before an inode's own lock. */
+static struct lock inodes_lock;
+
+/* Returns a hash of the sector of the inode whose key is E. */
+static uint64_t inode_hash(const struct hash_elem *e, void *aux UNUSED)
+{
+    return hash_int(hash_entry(e, struct inode_key, elem)->sector);
+}
+
+/* Orders the inodes whose keys are A and B by sector. */
+static bool inode_less(const struct hash_elem *a, const struct hash_elem *b, void *aux UNUSED)
+{
+    return hash_entry(a, struct inode_key, elem)->sector < hash_entry(b, struct inode_key, elem)->sector;
+}
 
 /* Initializes the inode module. */
 void inode_init(void)
 {
-    list_init(&open_inodes);
+    if (!hash_init(&inodes, inode_hash, inode_less, NULL))
+        PANIC("inode table creation failed");
+    list_init(&closed_inodes);
+    lock_init(&inodes_lock);
 }
 
 /* Initializes an inode with LENGTH bytes of data and
@@ -66,35 +974,37 @@ void inode_init(void)
  * Returns false if memory or disk allocation fails. */
 bool inode_create(disk_sector_t sector, off_t length)
 {
-    struct inode_disk *disk_inode = NULL;
+    struct inode *inode = NULL;
     bool success = false;
 
     ASSERT(length >= 0);
 
     /* If this assertion fails, the inode structure is not exactly
      * one sector in size, and you should fix that. */
-    ASSERT(sizeof *disk_inode == DISK_SECTOR_SIZE);
+    ASSERT(sizeof inode->data == DISK_SECTOR_SIZE);
+#if !defined EFILESYS && !defined INODE_INDEXED
+    ASSERT(sizeof(struct overflow_block) == DISK_SECTOR_SIZE);
+#endif
 
-    disk_inode = calloc(1, sizeof *disk_inode);
-    if (disk_inode != NULL)
+    inode = calloc(1, sizeof *inode);
+    if (inode != NULL)
     {
         size_t sectors = bytes_to_sectors(length);
-        disk_inode->length = length;
-        disk_inode->magic = INODE_MAGIC;
-        if (free_map_allocate(sectors, &disk_inode->start))
+
+        inode->key.sector = sector;
+        inode->data.length = length;
+        inode->data.magic = INODE_MAGIC;
+        list_init(&inode->pending);
+
+        /* The initial LENGTH bytes are placed up front, since the free
+         * map file itself is created here. */
+        if (data_create(inode, sectors))
         {
-            disk_write(filesys_disk, sector, disk_inode);
-            if (sectors > 0)
-            {
-                static char zeros[DISK_SECTOR_SIZE];
-                size_t i;
-
-                for (i = 0; i < sectors; i++)
-                    disk_write(filesys_disk, disk_inode->start + i, zeros);
-            }
+            inode_sync(inode);
             success = true;
-        }
-        free(disk_inode);
+        } else
+            data_release(inode);
+        inode_free(inode);
     }
     return success;
 }
@@ -104,32 +1014,53 @@ bool inode_create(disk_sector_t sector, off_t length)
  * Returns a null pointer if memory allocation fails. */
 struct inode *inode_open(disk_sector_t sector)
 {
-    struct list_elem *e;
+    struct inode_key key;
+    struct hash_elem *e;
     struct inode *inode;
 
-    /* Check whether this inode is already open. */
-    for (e = list_begin(&open_inodes); e != list_end(&open_inodes); e = list_next(e))
+    /* Check whether this inode is already open, or was closed
+     * recently. */
+    key.sector = sector;
+    lock_acquire(&inodes_lock);
+    e = hash_find(&inodes, &key.elem);
+    if (e != NULL)
     {
-        inode = list_entry(e, struct inode, elem);
-        if (inode->sector == sector)
-        {
-            inode_reopen(inode);
-            return inode;
-        }
+        inode = hash_entry(e, struct inode, key.elem);
+        if (inode->open_cnt++ == 0)
+            list_remove(&inode->elem);
+        lock_release(&inodes_lock);
+        return inode;
     }
 
     /* Allocate memory. */
     inode = malloc(sizeof *inode);
     if (inode == NULL)
+    {
+        lock_release(&inodes_lock);
         return NULL;
+    }
 
     /* Initialize. */
-    list_push_front(&open_inodes, &inode->elem);
-    inode->sector = sector;
+    inode->key.sector = sector;
     inode->open_cnt = 1;
     inode->deny_write_cnt = 0;
     inode->removed = false;
-    disk_read(filesys_disk, inode->sector, &inode->data);
+    lock_init(&inode->lock);
+    list_init(&inode->pending);
+    inode->pending_cnt = 0;
+    inode->reserved = 0;
+    buffer_cache_read(inode->key.sector, &inode->data, 0, DISK_SECTOR_SIZE);
+    if (!data_load(inode))
+    {
+        lock_release(&inodes_lock);
+        free(inode);
+        return NULL;
+    }
+
+    /* Only placed data is ever written out. */
+    inode->placed = bytes_to_sectors(inode->data.length);
+    hash_insert(&inodes, &inode->key.elem);
+    lock_release(&inodes_lock);
     return inode;
 }
 
@@ -137,19 +1068,25 @@ struct inode *inode_open(disk_sector_t sector)
 struct inode *inode_reopen(struct inode *inode)
 {
     if (inode != NULL)
+    {
+        lock_acquire(&inodes_lock);
         inode->open_cnt++;
+        lock_release(&inodes_lock);
+    }
     return inode;
 }
 
 /* Returns INODE's inode number. */
 disk_sector_t inode_get_inumber(const struct inode *inode)
 {
-    return inode->sector;
+    return inode->key.sector;
 }
 
 /* Closes INODE and writes it to disk.
- * If this was the last reference to INODE, frees its memory.
- * If INODE was also a removed inode, frees its blocks. */
+ * If this was the last reference to INODE, places its unplaced
+ * sectors and keeps it among the recently closed inodes.
+ * If INODE was also a removed inode, frees its blocks and its
+ * memory instead. */
 void inode_close(struct inode *inode)
 {
     /* Ignore null pointer. */
@@ -157,20 +1094,38 @@ void inode_close(struct inode *inode)
         return;
 
     /* Release resources if this was the last opener. */
+    lock_acquire(&inodes_lock);
     if (--inode->open_cnt == 0)
     {
-        /* Remove from inode list and release lock. */
-        list_remove(&inode->elem);
-
         /* Deallocate blocks if removed. */
         if (inode->removed)
         {
-            free_map_release(inode->sector, 1);
-            free_map_release(inode->data.start, bytes_to_sectors(inode->data.length));
+            hash_delete(&inodes, &inode->key.elem);
+            lock_release(&inodes_lock);
+            space_unreserve(inode->reserved);
+            pending_clear(inode);
+            space_release(inode->key.sector);
+            data_release(inode);
+            inode_free(inode);
+            return;
         }
 
-        free(inode);
+        /* Otherwise write it out and keep it, evicting the inode
+         * closed longest ago.  A writer may still be finishing with
+         * it, so it is placed under its own lock. */
+        lock_acquire(&inode->lock);
+        if (inode_unplaced(inode))
+            inode_place(inode);
+        lock_release(&inode->lock);
+        list_push_front(&closed_inodes, &inode->elem);
+        if (list_size(&closed_inodes) > CLOSED_INODE_CNT)
+        {
+            struct inode *victim = list_entry(list_pop_back(&closed_inodes), struct inode, elem);
+            hash_delete(&inodes, &victim->key.elem);
+            inode_free(victim);
+        }
     }
+    lock_release(&inodes_lock);
 }
 
 /* Marks INODE to be deleted when it is closed by the last caller who
@@ -178,7 +1133,28 @@ void inode_close(struct inode *inode)
 void inode_remove(struct inode *inode)
 {
     ASSERT(inode != NULL);
+    lock_acquire(&inodes_lock);
     inode->removed = true;
+    lock_release(&inodes_lock);
+}
+
+/* Places the unplaced sectors of every open inode. */
+void inode_flush(void)
+{
+    struct hash_iterator i;
+
+    lock_acquire(&inodes_lock);
+    hash_first(&i, &inodes);
+    while (hash_next(&i))
+    {
+        struct inode *inode = hash_entry(hash_cur(&i), struct inode, key.elem);
+
+        lock_acquire(&inode->lock);
+        if (inode_unplaced(inode))
+            inode_place(inode);
+        lock_release(&inode->lock);
+    }
+    lock_release(&inodes_lock);
 }
 
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
@@ -188,12 +1164,11 @@ off_t inode_read_at(struct inode *inode, void *buffer_, off_t size, off_t offset
 {
     uint8_t *buffer = buffer_;
     off_t bytes_read = 0;
-    uint8_t *bounce = NULL;
 
     while (size > 0)
     {
         /* Disk sector to read, starting byte offset within sector. */
-        disk_sector_t sector_idx = byte_to_sector(inode, offset);
+        disk_sector_t sector_idx;
         int sector_ofs = offset % DISK_SECTOR_SIZE;
 
         /* Bytes left in inode, bytes left in sector, lesser of the two. */
@@ -206,95 +1181,111 @@ off_t inode_read_at(struct inode *inode, void *buffer_, off_t size, off_t offset
         if (chunk_size <= 0)
             break;
 
-        if (sector_ofs == 0 && chunk_size == DISK_SECTOR_SIZE)
-        {
-            /* Read full sector directly into caller's buffer. */
-            disk_read(filesys_disk, sector_idx, buffer + bytes_read);
-        } else
+        /* A sector not placed yet is read from memory. */
+        lock_acquire(&inode->lock);
+        sector_idx = byte_to_sector(inode, offset);
+        if (sector_idx == 0)
         {
-            /* Read sector into bounce buffer, then partially copy
-             * into caller's buffer. */
-            if (bounce == NULL)
-            {
-                bounce = malloc(DISK_SECTOR_SIZE);
-                if (bounce == NULL)
-                    break;
-            }
-            disk_read(filesys_disk, sector_idx, bounce);
-            memcpy(buffer + bytes_read, bounce + sector_ofs, chunk_size);
+            struct pending_sector *p = pending_find(inode, offset / DISK_SECTOR_SIZE);
+            if (p != NULL)
+                memcpy(buffer + bytes_read, p->data + sector_ofs, chunk_size);
+            else
+                memset(buffer + bytes_read, 0, chunk_size);
         }
+        lock_release(&inode->lock);
+        if (sector_idx != 0)
+            buffer_cache_read(sector_idx, buffer + bytes_read, sector_ofs, chunk_size);
 
         /* Advance. */
         size -= chunk_size;
         offset += chunk_size;
         bytes_read += chunk_size;
     }
-    free(bounce);
 
     return bytes_read;
 }
 
+/* Starts reading the sectors that hold SIZE bytes of INODE at OFFSET
+ * into the buffer cache in the background, up to the end of the
+ * file. */
+void inode_readahead(struct inode *inode, off_t size, off_t offset)
+{
+    off_t end = offset + size;
+
+    lock_acquire(&inode->lock);
+    if (end > inode_length(inode))
+        end = inode_length(inode);
+    for (offset -= offset % DISK_SECTOR_SIZE; offset < end; offset += DISK_SECTOR_SIZE)
+    {
+        disk_sector_t sector = byte_to_sector(inode, offset);
+        if (sector != 0)
+            buffer_cache_readahead(sector);
+    }
+    lock_release(&inode->lock);
+}
+
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
  * Returns the number of bytes actually written, which may be
- * less than SIZE if end of file is reached or an error occurs.
- * (Normally a write at end of file would extend the inode, but
- * growth is not yet implemented.) */
+ * less than SIZE if the disk or memory fills up.  A write past the
+ * end of the file extends it.  A sector that is not on disk yet has
+ * room reserved for it, so that placing it later cannot fail, and
+ * no byte is written without that room. */
 off_t inode_write_at(struct inode *inode, const void *buffer_, off_t size, off_t offset)
 {
     const uint8_t *buffer = buffer_;
     off_t bytes_written = 0;
-    uint8_t *bounce = NULL;
+    bool grown = false;
 
     if (inode->deny_write_cnt)
         return 0;
 
+    lock_acquire(&inode->lock);
     while (size > 0)
     {
         /* Sector to write, starting byte offset within sector. */
         disk_sector_t sector_idx = byte_to_sector(inode, offset);
         int sector_ofs = offset % DISK_SECTOR_SIZE;
 
-        /* Bytes left in inode, bytes left in sector, lesser of the two. */
-        off_t inode_left = inode_length(inode) - offset;
+        /* Bytes left in sector. */
         int sector_left = DISK_SECTOR_SIZE - sector_ofs;
-        int min_left = inode_left < sector_left ? inode_left : sector_left;
 
         /* Number of bytes to actually write into this sector. */
-        int chunk_size = size < min_left ? size : min_left;
-        if (chunk_size <= 0)
+        int chunk_size = size < sector_left ? size : sector_left;
+
+        if (offset + chunk_size > inode->data.length && !space_grow(inode, offset + chunk_size))
             break;
 
-        if (sector_ofs == 0 && chunk_size == DISK_SECTOR_SIZE)
+        if (sector_idx != 0)
+            buffer_cache_write(sector_idx, buffer + bytes_written, sector_ofs, chunk_size);
+        else
         {
-            /* Write full sector directly to disk. */
-            disk_write(filesys_disk, sector_idx, buffer + bytes_written);
-        } else
-        {
-            /* We need a bounce buffer. */
-            if (bounce == NULL)
-            {
-                bounce = malloc(DISK_SECTOR_SIZE);
-                if (bounce == NULL)
-                    break;
-            }
-
-            /* If the sector contains data before or after the chunk
-               we're writing, then we need to read in the sector
-               first.  Otherwise we start with a sector of all zeros. */
-            if (sector_ofs > 0 || chunk_size < sector_left)
-                disk_read(filesys_disk, sector_idx, bounce);
-            else
-                memset(bounce, 0, DISK_SECTOR_SIZE);
-            memcpy(bounce + sector_ofs, buffer + bytes_written, chunk_size);
-            disk_write(filesys_disk, sector_idx, bounce);
+            size_t idx = offset / DISK_SECTOR_SIZE;
+            struct pending_sector *p = pending_find(inode, idx);
+
+            if (p == NULL && (!space_pending(inode) || (p = pending_add(inode, idx)) == NULL))
+                break;
+            memcpy(p->data + sector_ofs, buffer + bytes_written, chunk_size);
         }
 
         /* Advance. */
         size -= chunk_size;
         offset += chunk_size;
         bytes_written += chunk_size;
+        if (offset > inode->data.length)
+        {
+            inode->data.length = offset;
+            grown = true;
+        }
+
+        if (inode->pending_cnt >= DELALLOC_MAX)
+            inode_place(inode);
     }
-    free(bounce);
+
+    /* Until its sectors are placed, a grown inode is written out by
+     * inode_place(). */
+    if (grown && inode->placed == bytes_to_sectors(inode->data.length))
+        buffer_cache_write(inode->key.sector, &inode->data, 0, DISK_SECTOR_SIZE);
+    lock_release(&inode->lock);
 
     return bytes_written;
 }
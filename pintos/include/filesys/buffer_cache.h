@@ -0,0 +1,24 @@
+#ifndef FILESYS_BUFFER_CACHE_H
+#define FILESYS_BUFFER_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "devices/disk.h"
+
+/* Default number of sectors in the buffer cache. */
+#define BUFFER_CACHE_SIZE 64
+
+/* -bc: Number of sectors in the buffer cache. */
+extern size_t buffer_cache_size;
+
+/* -bcage: Timer ticks a sector may stay dirty in the cache. */
+extern int64_t buffer_cache_dirty_age;
+
+void buffer_cache_init(void);
+void buffer_cache_read(disk_sector_t sector, void *buffer, size_t ofs, size_t size);
+void buffer_cache_write(disk_sector_t sector, const void *buffer, size_t ofs, size_t size);
+void buffer_cache_readahead(disk_sector_t sector);
+void buffer_cache_flush(void);
+void buffer_cache_print_stats(void);
+
+#endif /* filesys/buffer_cache.h */
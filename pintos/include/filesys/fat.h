@@ -31,6 +31,9 @@ void fat_remove_chain(cluster_t clst, /* Cluster # to be removed */
 );
 cluster_t fat_get(cluster_t clst);
 void fat_put(cluster_t clst, cluster_t val);
+bool fat_reserve(size_t cnt);
+void fat_unreserve(size_t cnt);
 disk_sector_t cluster_to_sector(cluster_t clst);
+cluster_t sector_to_cluster(disk_sector_t sector);
 
 #endif /* filesys/fat.h */
@@ -3,14 +3,24 @@
 
 #include <stdbool.h>
 #include "filesys/off_t.h"
+#include "threads/synch.h"
 
 /* Sectors of system file inodes. */
 #define FREE_MAP_SECTOR 0 /* Free map file inode sector. */
+#ifdef EFILESYS
+#include "filesys/fat.h"
+#define ROOT_DIR_SECTOR cluster_to_sector(ROOT_DIR_CLUSTER) /* Root directory file inode sector. */
+#else
 #define ROOT_DIR_SECTOR 1 /* Root directory file inode sector. */
+#endif
 
 /* Disk used for file system. */
 extern struct disk *filesys_disk;
 
+/* Serializes file system operations, whether for a system call or
+ * for the VM paging a file in or out. */
+extern struct lock filesys_lock;
+
 void filesys_init(bool format);
 void filesys_done(void);
 bool filesys_create(const char *name, off_t initial_size);
@@ -14,8 +14,10 @@ struct inode *inode_reopen(struct inode *);
 disk_sector_t inode_get_inumber(const struct inode *);
 void inode_close(struct inode *);
 void inode_remove(struct inode *);
+void inode_flush(void);
 off_t inode_read_at(struct inode *, void *, off_t size, off_t offset);
 off_t inode_write_at(struct inode *, const void *, off_t size, off_t offset);
+void inode_readahead(struct inode *, off_t size, off_t offset);
 void inode_deny_write(struct inode *);
 void inode_allow_write(struct inode *);
 off_t inode_length(const struct inode *);
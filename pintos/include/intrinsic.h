@@ -50,6 +50,46 @@ __attribute__((always_inline)) static __inline uint64_t rcr3(void)
     return val;
 }
 
+__attribute__((always_inline)) static __inline uint64_t rcr4(void)
+{
+    uint64_t val;
+    __asm __volatile("movq %%cr4,%0" : "=r"(val));
+    return val;
+}
+
+__attribute__((always_inline)) static __inline void lcr4(uint64_t val)
+{
+    __asm __volatile("movq %0, %%cr4" : : "r"(val) : "memory");
+}
+
+/* Executes CPUID for LEAF and SUBLEAF.  See [IA32-v2a] "CPUID--CPU
+   Identification". */
+__attribute__((always_inline)) static __inline void cpuid(uint32_t leaf, uint32_t subleaf, uint32_t *eax,
+                                                          uint32_t *ebx, uint32_t *ecx, uint32_t *edx)
+{
+    __asm __volatile("cpuid" : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx) : "a"(leaf), "c"(subleaf));
+}
+
+/* Returns the time-stamp counter.  See [IA32-v2b] "RDTSC--Read
+   Time-Stamp Counter". */
+__attribute__((always_inline)) static __inline uint64_t rdtsc(void)
+{
+    uint32_t lo, hi;
+    __asm __volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return (uint64_t)hi << 32 | lo;
+}
+
+/* Invalidates TLB entries tagged with PCID, as TYPE selects.  See
+   [IA32-v2a] "INVPCID--Invalidate Process-Context Identifier". */
+__attribute__((always_inline)) static __inline void invpcid(uint64_t type, uint64_t pcid, uint64_t addr)
+{
+    struct {
+        uint64_t pcid;
+        uint64_t addr;
+    } desc = {pcid, addr};
+    __asm __volatile("invpcid %0, %1" : : "m"(desc), "r"(type) : "memory");
+}
+
 __attribute__((always_inline)) static __inline uint64_t rrax(void)
 {
     uint64_t val;
@@ -0,0 +1,15 @@
+#ifndef __LIB_MEMSTAT_H
+#define __LIB_MEMSTAT_H
+
+#include <stddef.h>
+
+/* Memory use of a process, filled in by memstat(). */
+struct memstat {
+    size_t rss;             /* Pages resident in memory. */
+    size_t wss;             /* Working set: pages recently accessed. */
+    size_t rss_limit;       /* Soft limit on RSS in pages, or 0 for none. */
+    long long minor_faults; /* Page faults served without disk I/O. */
+    long long major_faults; /* Page faults that read from disk. */
+};
+
+#endif /* lib/memstat.h */
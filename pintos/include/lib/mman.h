@@ -0,0 +1,14 @@
+#ifndef __LIB_MMAN_H
+#define __LIB_MMAN_H
+
+/* Flags that may be OR'd into mmap()'s WRITABLE argument. */
+#define MAP_POPULATE 0x100 /* Read the whole mapping in before returning. */
+
+/* Access-pattern hints for madvise(). */
+#define MADV_NORMAL 0     /* No special treatment. */
+#define MADV_RANDOM 1     /* Expect random access: no read-ahead. */
+#define MADV_SEQUENTIAL 2 /* Expect sequential access: read ahead, drop behind. */
+#define MADV_WILLNEED 3   /* Expect access soon: prefetch in the background. */
+#define MADV_DONTNEED 4   /* Not needed soon: drop clean pages now. */
+
+#endif /* lib/mman.h */
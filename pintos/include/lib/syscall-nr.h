@@ -36,6 +36,11 @@ enum {
 
     SYS_MOUNT,
     SYS_UMOUNT,
+
+    /* Extra for Project 3 */
+    SYS_MADVISE,   /* Give the kernel an access-pattern hint. */
+    SYS_MEMSTAT,   /* Report this process's memory use. */
+    SYS_RSS_LIMIT, /* Set this process's soft resident-set limit. */
 };
 
 #endif /* lib/syscall-nr.h */
@@ -2,19 +2,36 @@
 #define THREAD_MMU_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include "threads/pte.h"
 
 typedef bool pte_for_each_func(uint64_t *pte, void *va, void *aux);
 
+/* Most addresses a TLB gather invalidates one by one.  Beyond this,
+ * it flushes the whole address space instead. */
+#define TLB_GATHER_MAX 32
+
+/* A batch of TLB invalidations for pages cleared from one pml4. */
+struct tlb_gather {
+    uint64_t *pml4;           /* Page map level 4 being cleared. */
+    size_t cnt;               /* Addresses gathered, capped past TLB_GATHER_MAX. */
+    void *va[TLB_GATHER_MAX]; /* The first TLB_GATHER_MAX of them. */
+};
+
 uint64_t *pml4e_walk(uint64_t *pml4, const uint64_t va, int create);
+uint64_t *pml4_pde_walk(uint64_t *pml4, const uint64_t va, int create);
 uint64_t *pml4_create(void);
 bool pml4_for_each(uint64_t *, pte_for_each_func *, void *);
 void pml4_destroy(uint64_t *pml4);
 void pml4_activate(uint64_t *pml4);
+void pml4_pcid_init(void);
 void *pml4_get_page(uint64_t *pml4, const void *upage);
 bool pml4_set_page(uint64_t *pml4, void *upage, void *kpage, bool rw);
+bool pml4_set_huge_page(uint64_t *pml4, void *upage, void *kpage, bool rw);
 void pml4_clear_page(uint64_t *pml4, void *upage);
+void tlb_gather_begin(struct tlb_gather *tlb, uint64_t *pml4);
+void tlb_gather_finish(struct tlb_gather *tlb);
 bool pml4_is_dirty(uint64_t *pml4, const void *upage);
 void pml4_set_dirty(uint64_t *pml4, const void *upage, bool dirty);
 bool pml4_is_accessed(uint64_t *pml4, const void *upage);
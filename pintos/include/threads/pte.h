@@ -41,5 +41,12 @@
 #define PTE_U 0x4                           /* 1=user/kernel, 0=kernel only. */
 #define PTE_A 0x20                          /* 1=accessed, 0=not acccessed. */
 #define PTE_D 0x40                          /* 1=dirty, 0=not dirty (PTEs only). */
+#define PTE_PS 0x80                         /* 1=2 MiB page (page-directory entries only). */
+
+/* A page-directory entry with PTE_PS set maps a 2 MiB "huge" page
+ * directly, with no page table below it. */
+#define HPGSIZE (1UL << PDXSHIFT)                    /* Bytes in a huge page. */
+#define HPGCNT (HPGSIZE / PGSIZE)                    /* Pages in a huge page. */
+#define HPTE_ADDR(pde) ((uint64_t)(pde) & ~(HPGSIZE - 1)) /* Frame address in a huge PDE. */
 
 #endif /* threads/pte.h */
@@ -108,10 +108,12 @@ struct thread {
 #ifdef USERPROG
     /* Owned by userprog/process.c. */
     uint64_t *pml4; /* Page map level 4 */
+    struct tlb_gather *tlb_gather; /* Batch of TLB flushes being gathered, or NULL. */
 #endif
 #ifdef VM
     /* Table for whole virtual memory owned by thread. */
     struct supplemental_page_table spt;
+    uintptr_t user_rsp; /* User rsp saved at syscall entry. */
 #endif
 
     /* Owned by thread.c. */
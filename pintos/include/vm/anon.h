@@ -4,9 +4,15 @@
 struct page;
 enum vm_type;
 
-struct anon_page {};
+struct zswap_entry;
+
+struct anon_page {
+    size_t swap_slot;          /* Swap slot holding the page, or BITMAP_ERROR. */
+    struct zswap_entry *zswap; /* Compressed copy in memory, or NULL. */
+};
 
 void vm_anon_init(void);
 bool anon_initializer(struct page *page, enum vm_type type, void *kva);
+void vm_anon_print_stats(void);
 
 #endif
@@ -6,10 +6,23 @@
 struct page;
 enum vm_type;
 
-struct file_page {};
+/* A page whose contents come from a file.  The same structure, allocated
+ * with malloc(), is the AUX of every lazily loaded page, file-backed or
+ * not; uninit_destroy() frees it if the page is never touched. */
+struct file_page {
+    struct file *file;   /* Private handle, reopened for this page. */
+    off_t ofs;           /* Offset of the page's data in FILE. */
+    uint32_t read_bytes; /* Bytes to read; the rest of the page is zero. */
+    void *map_addr;      /* Start of the mmap() region, or NULL. */
+};
 
 void vm_file_init(void);
 bool file_backed_initializer(struct page *page, enum vm_type type, void *kva);
 void *do_mmap(void *addr, size_t length, int writable, struct file *file, off_t offset);
 void do_munmap(void *va);
+bool file_backed_writeback(struct page *page);
+
+void *file_page_mapping(struct page *page);
+struct file_page *file_page_duplicate(const struct file_page *file_page);
+void file_page_free(struct file_page *file_page);
 #endif
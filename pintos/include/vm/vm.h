@@ -1,7 +1,10 @@
 #ifndef VM_VM_H
 #define VM_VM_H
 #include <stdbool.h>
+#include <hash.h>
+#include <list.h>
 #include "threads/palloc.h"
+#include "threads/synch.h"
 
 enum vm_type {
     /* page not initialized */
@@ -20,6 +23,14 @@ enum vm_type {
     VM_MARKER_0 = (1 << 3),
     VM_MARKER_1 = (1 << 4),
 
+    /* Page is part of the user stack. */
+    VM_STACK = VM_MARKER_0,
+
+    /* Page is loaded from the program's executable.  Until its first
+     * write, it maps a frame shared by every process running the same
+     * executable. */
+    VM_TEXT = VM_MARKER_1,
+
     /* DO NOT EXCEED THIS VALUE. */
     VM_MARKER_END = (1 << 31),
 };
@@ -33,9 +44,27 @@ enum vm_type {
 
 struct page_operations;
 struct thread;
+struct shared_frame;
+struct memstat;
+
+/* -ksm: Frames the same-page merging daemon scans per batch. */
+extern size_t ksm_pages_to_scan;
+
+/* -rss: Default soft RSS limit of a process in pages. */
+extern size_t rss_soft_limit;
 
 #define VM_TYPE(type) ((type)&7)
 
+/* Kinds of page faults, as vm_try_handle_fault() resolves them. */
+enum vm_fault {
+    VM_FAULT_MINOR,   /* Served from memory. */
+    VM_FAULT_MAJOR,   /* Read the page from the swap disk or a file. */
+    VM_FAULT_COW,     /* Gave a shared read-only frame a private copy. */
+    VM_FAULT_STACK,   /* Grew the stack. */
+    VM_FAULT_INVALID, /* Bad access. */
+    VM_FAULT_CNT      /* Number of kinds. */
+};
+
 /* The representation of "page".
  * This is kind of "parent class", which has four "child class"es, which are
  * uninit_page, file_page, anon_page, and page cache (project4).
@@ -46,6 +75,12 @@ struct page {
     struct frame *frame; /* Back reference for frame */
 
     /* Your implementation */
+    struct hash_elem spt_elem;   /* Element in the owner's supplemental page table. */
+    struct thread *owner;        /* Process whose page table maps VA. */
+    bool writable;               /* May user code write to this page? */
+    int advice;                  /* MADV_* access-pattern hint from madvise(). */
+    bool zero_mapped;            /* Mapped read-only to the shared zero frame. */
+    struct shared_frame *shared; /* Read-only frame shared with other pages, or NULL. */
 
     /* Per-type data are binded into the union.
      * Each function automatically detects the current union */
@@ -63,6 +98,9 @@ struct page {
 struct frame {
     void *kva;
     struct page *page;
+    struct list_elem elem; /* Element in the frame table. */
+    bool pinned;           /* Exempt from eviction while its contents move. */
+    bool writeback;        /* Being written back by vm_writebackd or for eviction. */
 };
 
 /* The function table for page operations.
@@ -85,7 +123,25 @@ struct page_operations {
 /* Representation of current process's memory space.
  * We don't want to force you to obey any specific design for this struct.
  * All designs up to you for this. */
-struct supplemental_page_table {};
+struct supplemental_page_table {
+    struct hash pages; /* Pages keyed by user virtual address. */
+    struct lock lock;  /* Serializes table changes against kernel daemons. */
+
+    void *stack_bottom;      /* Lowest page of the user stack. */
+    int64_t stack_grow_tick; /* When the stack last grew. */
+    size_t stack_grow_cnt;   /* Pages the last growth added below the fault. */
+
+    /* Memory use, protected by the frame table's lock. */
+    size_t rss;          /* Pages resident in frames of their own. */
+    size_t rss_limit;    /* Soft limit on RSS, or 0 for none. */
+    size_t wss;          /* Pages accessed in the last complete clock sweep. */
+    size_t wss_sample;   /* Pages accessed so far in sweep WSS_SWEEP. */
+    unsigned wss_sweep;  /* Clock sweep WSS_SAMPLE belongs to. */
+
+    /* Page faults resolved, protected by LOCK. */
+    long long minor_faults; /* Without waiting for a disk. */
+    long long major_faults; /* By reading the swap disk or a file. */
+};
 
 #include "threads/thread.h"
 void supplemental_page_table_init(struct supplemental_page_table *spt);
@@ -96,12 +152,23 @@ bool spt_insert_page(struct supplemental_page_table *spt, struct page *page);
 void spt_remove_page(struct supplemental_page_table *spt, struct page *page);
 
 void vm_init(void);
-bool vm_try_handle_fault(struct intr_frame *f, void *addr, bool user, bool write, bool not_present);
+enum vm_fault vm_try_handle_fault(struct intr_frame *f, void *addr, bool user, bool write, bool not_present);
+bool vm_is_stack_addr(void *addr);
 
 #define vm_alloc_page(type, upage, writable) vm_alloc_page_with_initializer((type), (upage), (writable), NULL, NULL)
 bool vm_alloc_page_with_initializer(enum vm_type type, void *upage, bool writable, vm_initializer *init, void *aux);
 void vm_dealloc_page(struct page *page);
 bool vm_claim_page(void *va);
 enum vm_type page_get_type(struct page *page);
+bool vm_madvise(void *addr, size_t length, int advice);
+void vm_print_stats(void);
+void vm_set_rss_limit(size_t limit);
+void vm_memstat(struct memstat *st);
+
+bool vm_frame_pin(struct page *page);
+void vm_frame_unpin(struct page *page);
+bool vm_pin_user(void *addr, size_t length, bool write);
+void vm_unpin_user(void *addr, size_t length);
+void vm_frame_free(struct page *page);
 
 #endif /* VM_VM_H */
@@ -135,6 +135,21 @@ void munmap(void *addr)
     syscall1(SYS_MUNMAP, addr);
 }
 
+int madvise(void *addr, size_t length, int advice)
+{
+    return syscall3(SYS_MADVISE, addr, length, advice);
+}
+
+bool memstat(struct memstat *st)
+{
+    return syscall1(SYS_MEMSTAT, st);
+}
+
+void rss_limit(size_t pages)
+{
+    syscall1(SYS_RSS_LIMIT, pages);
+}
+
 bool chdir(const char *dir)
 {
     return syscall1(SYS_CHDIR, dir);
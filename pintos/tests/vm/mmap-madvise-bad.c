@@ -0,0 +1,33 @@
+/* Passes bad arguments to madvise(), each of which must make it
+   return -1, and checks that the mapping still reads correctly. */
+
+#include <mman.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/vm/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define ACTUAL ((char *)0x10000000)
+
+void test_main(void)
+{
+    int handle;
+
+    CHECK((handle = open("sample.txt")) > 1, "open \"sample.txt\"");
+    CHECK(mmap(ACTUAL, 4096, 0, handle, 0) == ACTUAL, "mmap \"sample.txt\"");
+
+    CHECK(madvise(ACTUAL + 1, 4096, MADV_DONTNEED) == -1, "madvise misaligned address");
+    CHECK(madvise(ACTUAL, 0, MADV_DONTNEED) == -1, "madvise zero length");
+    CHECK(madvise(ACTUAL, 4096, 99) == -1, "madvise unknown advice");
+    CHECK(madvise(ACTUAL, 2 * 4096, MADV_DONTNEED) == -1, "madvise past the end of the mapping");
+    CHECK(madvise((void *)0x20000000, 4096, MADV_WILLNEED) == -1, "madvise unmapped memory");
+    CHECK(madvise((void *)0x8004000000, 4096, MADV_DONTNEED) == -1, "madvise kernel memory");
+
+    if (memcmp(ACTUAL, sample, strlen(sample)))
+        fail("read of mmap'd file reported bad data");
+    msg("validated");
+
+    munmap(ACTUAL);
+    close(handle);
+}
@@ -0,0 +1,19 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(mmap-madvise-bad) begin
+(mmap-madvise-bad) open "sample.txt"
+(mmap-madvise-bad) mmap "sample.txt"
+(mmap-madvise-bad) madvise misaligned address
+(mmap-madvise-bad) madvise zero length
+(mmap-madvise-bad) madvise unknown advice
+(mmap-madvise-bad) madvise past the end of the mapping
+(mmap-madvise-bad) madvise unmapped memory
+(mmap-madvise-bad) madvise kernel memory
+(mmap-madvise-bad) validated
+(mmap-madvise-bad) end
+mmap-madvise-bad: exit(0)
+EOF
+pass;
@@ -0,0 +1,70 @@
+/* Gives each madvise() hint to a file mapping and checks its effect:
+   MADV_RANDOM faults in one page per access, MADV_SEQUENTIAL reads
+   ahead, and MADV_DONTNEED drops the clean pages, which read back
+   the same from the file. */
+
+#include <mman.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+#include "tests/vm/large.inc"
+
+#define ACTUAL ((char *)0x10000000)
+#define PAGE_SIZE 4096
+#define PAGE_CNT 64
+#define HALF (PAGE_CNT / 2 * PAGE_SIZE)
+
+/* Reads a byte of each of the CNT pages at P, and returns the number
+   of page faults that took. */
+static long long touch(const char *p, size_t cnt)
+{
+    struct memstat before, after;
+    volatile char c;
+    size_t i;
+
+    memstat(&before);
+    for (i = 0; i < cnt; i++)
+        c = p[i * PAGE_SIZE];
+    memstat(&after);
+    (void)c;
+    return after.minor_faults + after.major_faults - before.minor_faults - before.major_faults;
+}
+
+void test_main(void)
+{
+    struct memstat before, after;
+    long long faults;
+    int handle;
+
+    CHECK((handle = open("large.txt")) > 1, "open \"large.txt\"");
+    CHECK(mmap(ACTUAL, PAGE_CNT * PAGE_SIZE, 0, handle, 0) == ACTUAL, "mmap \"large.txt\"");
+    CHECK(madvise(ACTUAL, HALF, MADV_RANDOM) == 0, "madvise first half MADV_RANDOM");
+    CHECK(madvise(ACTUAL + HALF, HALF, MADV_SEQUENTIAL) == 0, "madvise second half MADV_SEQUENTIAL");
+
+    faults = touch(ACTUAL, PAGE_CNT / 2);
+    if (faults != PAGE_CNT / 2)
+        fail("%d random reads took %lld page faults", PAGE_CNT / 2, faults);
+    msg("random reads fault once per page");
+
+    faults = touch(ACTUAL + HALF, PAGE_CNT / 2);
+    if (faults >= PAGE_CNT / 2)
+        fail("%d sequential reads took %lld page faults", PAGE_CNT / 2, faults);
+    msg("sequential reads are read ahead");
+
+    memstat(&before);
+    CHECK(madvise(ACTUAL, PAGE_CNT * PAGE_SIZE, MADV_DONTNEED) == 0, "madvise MADV_DONTNEED");
+    memstat(&after);
+    if (after.rss >= before.rss)
+        fail("MADV_DONTNEED left RSS at %zu pages", after.rss);
+    msg("MADV_DONTNEED dropped pages");
+
+    CHECK(madvise(ACTUAL, PAGE_CNT * PAGE_SIZE, MADV_WILLNEED) == 0, "madvise MADV_WILLNEED");
+    CHECK(madvise(ACTUAL, PAGE_CNT * PAGE_SIZE, MADV_NORMAL) == 0, "madvise MADV_NORMAL");
+    if (memcmp(ACTUAL, large, PAGE_CNT * PAGE_SIZE))
+        fail("read of mapping reported bad data");
+    msg("validated");
+
+    munmap(ACTUAL);
+    close(handle);
+}
@@ -0,0 +1,20 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(mmap-madvise) begin
+(mmap-madvise) open "large.txt"
+(mmap-madvise) mmap "large.txt"
+(mmap-madvise) madvise first half MADV_RANDOM
+(mmap-madvise) madvise second half MADV_SEQUENTIAL
+(mmap-madvise) random reads fault once per page
+(mmap-madvise) sequential reads are read ahead
+(mmap-madvise) madvise MADV_DONTNEED
+(mmap-madvise) MADV_DONTNEED dropped pages
+(mmap-madvise) madvise MADV_WILLNEED
+(mmap-madvise) madvise MADV_NORMAL
+(mmap-madvise) validated
+(mmap-madvise) end
+EOF
+pass;
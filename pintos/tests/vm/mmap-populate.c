@@ -0,0 +1,46 @@
+/* Maps part of a file with MAP_POPULATE, which must read the whole
+   mapping in before mmap() returns, so that reading it afterward
+   takes no page faults. */
+
+#include <mman.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+#include "tests/vm/large.inc"
+
+#define ACTUAL ((char *)0x10000000)
+#define PAGE_SIZE 4096
+#define PAGE_CNT 64
+
+void test_main(void)
+{
+    struct memstat before, after;
+    unsigned long sum = 0;
+    int handle;
+    size_t i;
+
+    CHECK((handle = open("large.txt")) > 1, "open \"large.txt\"");
+    CHECK(mmap(ACTUAL, PAGE_CNT * PAGE_SIZE, MAP_POPULATE, handle, 0) == ACTUAL,
+          "mmap \"large.txt\" with MAP_POPULATE");
+
+    /* Read a byte of every page, with nothing else in between. */
+    memstat(&before);
+    for (i = 0; i < PAGE_CNT; i++)
+        sum += ACTUAL[i * PAGE_SIZE];
+    memstat(&after);
+
+    if (after.minor_faults != before.minor_faults || after.major_faults != before.major_faults)
+        fail("reading the populated mapping took %lld page faults",
+             after.minor_faults + after.major_faults - before.minor_faults - before.major_faults);
+    msg("read the mapping without page faults");
+
+    for (i = 0; i < PAGE_CNT; i++)
+        sum -= large[i * PAGE_SIZE];
+    if (sum != 0 || memcmp(ACTUAL, large, PAGE_CNT * PAGE_SIZE))
+        fail("read of populated mapping reported bad data");
+    msg("validated");
+
+    munmap(ACTUAL);
+    close(handle);
+}
@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(mmap-populate) begin
+(mmap-populate) open "large.txt"
+(mmap-populate) mmap "large.txt" with MAP_POPULATE
+(mmap-populate) read the mapping without page faults
+(mmap-populate) validated
+(mmap-populate) end
+EOF
+pass;
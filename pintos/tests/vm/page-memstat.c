@@ -0,0 +1,52 @@
+/* Checks that memstat() accounts for the pages a process touches.
+   The first write to each page of a zeroed array is a page fault
+   that makes the page resident; writing the pages again takes no
+   fault at all.  Last, asking memstat() to write into the code
+   segment must terminate the process with -1 exit code. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define PAGE_CNT 64
+
+static char pages[PAGE_CNT * PAGE_SIZE];
+
+/* Writes a byte to each page of PAGES, and returns the number of
+   page faults that took.  Stores the memory statistics from before
+   and after into *BEFORE and *AFTER. */
+static long long touch(struct memstat *before, struct memstat *after)
+{
+    size_t i;
+
+    memstat(before);
+    for (i = 0; i < PAGE_CNT; i++)
+        pages[i * PAGE_SIZE] = i + 1;
+    memstat(after);
+    return after->minor_faults + after->major_faults - before->minor_faults - before->major_faults;
+}
+
+void test_main(void)
+{
+    struct memstat before, after;
+    long long faults;
+
+    faults = touch(&before, &after);
+    if (faults < PAGE_CNT)
+        fail("first writes to %d pages took only %lld page faults", PAGE_CNT, faults);
+    if (after.rss < before.rss + PAGE_CNT)
+        fail("RSS grew from %zu to %zu pages after writing %d", before.rss, after.rss, PAGE_CNT);
+    msg("first writes fault the pages in");
+
+    faults = touch(&before, &after);
+    if (faults != 0)
+        fail("writes to resident pages took %lld page faults", faults);
+    if (after.rss != before.rss)
+        fail("RSS changed from %zu to %zu pages", before.rss, after.rss);
+    msg("second writes take no faults");
+
+    msg("memstat into the code segment");
+    memstat((struct memstat *)test_main);
+    fail("memstat() wrote into the code segment");
+}
@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(page-memstat) begin
+(page-memstat) first writes fault the pages in
+(page-memstat) second writes take no faults
+(page-memstat) memstat into the code segment
+page-memstat: exit(-1)
+EOF
+pass;
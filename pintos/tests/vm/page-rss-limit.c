@@ -0,0 +1,38 @@
+/* Sets a soft RSS limit, which memstat() must report, then writes
+   more anonymous memory than fits in RAM.  The limit makes this
+   process the first one evicted from, but every page must still
+   read back what was written to it.
+   For this test, Pintos memory size is 8MB. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define ONE_MB (1 << 20)
+#define CHUNK_SIZE (12 * ONE_MB)
+#define PAGE_COUNT (CHUNK_SIZE / PAGE_SIZE)
+#define LIMIT 256
+
+static char big_chunks[CHUNK_SIZE];
+
+void test_main(void)
+{
+    struct memstat st;
+    size_t i;
+
+    rss_limit(LIMIT);
+    CHECK(memstat(&st) && st.rss_limit == LIMIT, "set RSS limit to %d pages", LIMIT);
+
+    for (i = 0; i < PAGE_COUNT; i++)
+        big_chunks[i * PAGE_SIZE] = (char)i;
+    msg("wrote %d pages", PAGE_COUNT);
+
+    for (i = 0; i < PAGE_COUNT; i++)
+        if (big_chunks[i * PAGE_SIZE] != (char)i)
+            fail("data is inconsistent at page %zu", i);
+    msg("checked %d pages", PAGE_COUNT);
+
+    rss_limit(0);
+    CHECK(memstat(&st) && st.rss_limit == 0, "remove RSS limit");
+}
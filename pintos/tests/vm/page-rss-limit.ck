@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(page-rss-limit) begin
+(page-rss-limit) set RSS limit to 256 pages
+(page-rss-limit) wrote 3072 pages
+(page-rss-limit) checked 3072 pages
+(page-rss-limit) remove RSS limit
+(page-rss-limit) end
+EOF
+pass;
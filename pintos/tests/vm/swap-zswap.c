@@ -0,0 +1,56 @@
+/* Fills more anonymous memory than fits in RAM with pages that
+   compress well, interleaved with pages that do not.  Eviction then
+   goes through the compressed pool, overflows it to the swap disk,
+   and sends the incompressible pages straight to disk.  Every page
+   must read back intact.
+   For this test, Pintos memory size is 8MB. */
+
+#include <stdint.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define ONE_MB (1 << 20)
+#define CHUNK_SIZE (12 * ONE_MB)
+#define PAGE_COUNT (CHUNK_SIZE / PAGE_SIZE)
+
+static char big_chunks[CHUNK_SIZE];
+
+/* Returns byte OFS of page IDX.  Every fourth page is noise; the
+   others repeat a short pattern that is different for each page. */
+static char page_byte(size_t idx, size_t ofs)
+{
+    if (idx % 4 == 3)
+    {
+        uint32_t x = (uint32_t)(idx * PAGE_SIZE + ofs) * 2654435761u;
+        x ^= x >> 15;
+        x *= 2246822519u;
+        return (char)(x ^ (x >> 13));
+    }
+    return (char)(ofs % 16 == 0 ? idx : idx >> (ofs % 16 / 4));
+}
+
+void test_main(void)
+{
+    size_t i, j;
+
+    for (i = 0; i < PAGE_COUNT; i++)
+    {
+        char *page = big_chunks + i * PAGE_SIZE;
+        if (!(i % 1024))
+            msg("write page %zu", i);
+        for (j = 0; j < PAGE_SIZE; j++)
+            page[j] = page_byte(i, j);
+    }
+
+    for (i = 0; i < PAGE_COUNT; i++)
+    {
+        const char *page = big_chunks + i * PAGE_SIZE;
+        for (j = 0; j < PAGE_SIZE; j++)
+            if (page[j] != page_byte(i, j))
+                fail("byte %zu of page %zu is inconsistent", j, i);
+        if (!(i % 1024))
+            msg("check consistency in page %zu", i);
+    }
+}
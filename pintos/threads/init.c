@@ -34,6 +34,7 @@
 #endif
 #ifdef FILESYS
 #include "devices/disk.h"
+#include "filesys/buffer_cache.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #endif
@@ -104,6 +105,9 @@ int main(void)
     thread_start();
     serial_init_queue();
     timer_calibrate();
+#ifdef USERPROG
+    process_reaper_init();
+#endif
 
 #ifdef FILESYS
     /* Initialize file system. */
@@ -151,10 +155,21 @@ static void paging_init(uint64_t mem_end)
     extern char start, _end_kernel_text;
     // Maps physical address [0 ~ mem_end] to
     //   [LOADER_KERN_BASE ~ LOADER_KERN_BASE + mem_end].
+    // Uses 2 MiB pages wherever the kernel text, which must stay
+    // read-only, does not get in the way.
     for (uint64_t pa = 0; pa < mem_end; pa += PGSIZE)
     {
         uint64_t va = (uint64_t)ptov(pa);
 
+        if (pa % HPGSIZE == 0 && pa + HPGSIZE <= mem_end &&
+            (va + HPGSIZE <= (uint64_t)&start || va >= (uint64_t)&_end_kernel_text))
+        {
+            if ((pte = pml4_pde_walk(pml4, va, 1)) != NULL)
+                *pte = pa | PTE_P | PTE_W | PTE_PS;
+            pa += HPGSIZE - PGSIZE;
+            continue;
+        }
+
         perm = PTE_P | PTE_W;
         if ((uint64_t)&start <= va && va < (uint64_t)&_end_kernel_text)
             perm &= ~PTE_W;
@@ -165,6 +180,7 @@ static void paging_init(uint64_t mem_end)
 
     // reload cr3
     pml4_activate(0);
+    pml4_pcid_init();
 }
 
 /* Breaks the kernel command line into words and returns them as
@@ -218,6 +234,10 @@ static char **parse_options(char **argv)
 #ifdef FILESYS
         else if (!strcmp(name, "-f"))
             format_filesys = true;
+        else if (!strcmp(name, "-bc"))
+            buffer_cache_size = atoi(value);
+        else if (!strcmp(name, "-bcage"))
+            buffer_cache_dirty_age = atoi(value);
 #endif
         else if (!strcmp(name, "-rs"))
             random_init(atoi(value));
@@ -228,6 +248,12 @@ static char **parse_options(char **argv)
             user_page_limit = atoi(value);
         else if (!strcmp(name, "-threads-tests"))
             thread_tests = true;
+#endif
+#ifdef VM
+        else if (!strcmp(name, "-ksm"))
+            ksm_pages_to_scan = atoi(value);
+        else if (!strcmp(name, "-rss"))
+            rss_soft_limit = atoi(value);
 #endif
         else
             PANIC("unknown option `%s' (use -h for help)", name);
@@ -325,10 +351,18 @@ static void usage(void)
            "  -h                 Print this help message and power off.\n"
            "  -q                 Power off VM after actions or on panic.\n"
            "  -f                 Format file system disk during startup.\n"
+#ifdef FILESYS
+           "  -bc=COUNT          Cache COUNT file system disk sectors.\n"
+           "  -bcage=TICKS       Write back sectors dirty for TICKS timer ticks.\n"
+#endif
            "  -rs=SEED           Set random number seed to SEED.\n"
            "  -mlfqs             Use multi-level feedback queue scheduler.\n"
 #ifdef USERPROG
            "  -ul=COUNT          Limit user memory to COUNT pages.\n"
+#endif
+#ifdef VM
+           "  -ksm=COUNT         Merge identical user pages, scanning COUNT per 100 ms.\n"
+           "  -rss=COUNT         Prefer evicting pages of processes with over COUNT resident.\n"
 #endif
     );
     power_off();
@@ -357,10 +391,14 @@ static void print_stats(void)
     thread_print_stats();
 #ifdef FILESYS
     disk_print_stats();
+    buffer_cache_print_stats();
 #endif
     console_print_stats();
     kbd_print_stats();
 #ifdef USERPROG
     exception_print_stats();
 #endif
+#ifdef VM
+    vm_print_stats();
+#endif
 }
@@ -2,12 +2,253 @@
 #include <stddef.h>
 #include <string.h>
 #include "threads/init.h"
+#include "threads/interrupt.h"
 #include "threads/pte.h"
 #include "threads/palloc.h"
 #include "threads/thread.h"
 #include "threads/mmu.h"
 #include "intrinsic.h"
 
+/* Process-context identifiers (PCIDs).
+ *
+ * With CR4.PCIDE set, the TLB tags its entries with the PCID in the
+ * low 12 bits of CR3, and loading CR3 with CR3_NOFLUSH keeps them, so
+ * switching between processes does not flush the TLB.  PCID 0 is
+ * base_pml4's.  The others are handed out in generations: a pml4 keeps
+ * the PCID it was given until all of them are used up, when the whole
+ * TLB is flushed once and a new generation starts.  A PCID is never
+ * given out twice in a generation, so dropping a pml4's PCID is enough
+ * to forget every stale entry it has in the TLB.
+ *
+ * A pml4 records its PCID and generation in entry PML4_PCID_SLOT,
+ * which lies past the kernel's mappings and is never present. */
+#define CR4_PGE (1 << 7)           /* Global pages. */
+#define CR4_PCIDE (1 << 17)        /* PCIDs. */
+#define CR3_NOFLUSH (1ULL << 63)   /* Keep the TLB when loading CR3. */
+#define PCID_CNT 4096              /* Number of PCIDs. */
+#define PML4_PCID_SLOT 511         /* PML4 entry holding the PCID. */
+#define INVPCID_ADDR 0             /* INVPCID: one address. */
+#define INVPCID_CONTEXT 1          /* INVPCID: one PCID. */
+#define INVPCID_ALL 2              /* INVPCID: everything. */
+#define CPUID_PCID (1 << 17)       /* CPUID.01H:ECX, PCIDs supported. */
+#define CPUID_INVPCID (1 << 10)    /* CPUID.(07H,0):EBX, INVPCID supported. */
+#define PCID_ENTRY(gen, pcid) ((gen) << 13 | (uint64_t)(pcid) << 1)
+
+static bool pcid_enabled;   /* CR4.PCIDE is set. */
+static bool invpcid_usable; /* The CPU has INVPCID. */
+static uint64_t pcid_gen = 1;
+static unsigned pcid_next = 1;
+
+/* Turns PCIDs on, if the CPU has them.  Called once, with base_pml4
+ * active. */
+void pml4_pcid_init(void)
+{
+    uint32_t eax, ebx, ecx, edx;
+
+    ASSERT(base_pml4[PML4_PCID_SLOT] == 0);
+    cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+    if (!(ecx & CPUID_PCID))
+        return;
+    cpuid(0, 0, &eax, &ebx, &ecx, &edx);
+    if (eax >= 7)
+    {
+        cpuid(7, 0, &eax, &ebx, &ecx, &edx);
+        invpcid_usable = (ebx & CPUID_INVPCID) != 0;
+    }
+
+    ASSERT((rcr3() & 0xfff) == 0);
+    lcr4(rcr4() | CR4_PCIDE);
+    pcid_enabled = true;
+}
+
+/* Returns PML4's PCID, or 0 if it has none in this generation. */
+static unsigned pml4_pcid(uint64_t *pml4)
+{
+    uint64_t entry = pml4[PML4_PCID_SLOT];
+    return (entry >> 13) == pcid_gen ? (entry >> 1) & (PCID_CNT - 1) : 0;
+}
+
+/* Flushes the whole TLB, for every PCID. */
+static void tlb_flush_all(void)
+{
+    if (invpcid_usable)
+        invpcid(INVPCID_ALL, 0, 0);
+    else
+    {
+        /* Any change to CR4.PGE flushes everything. */
+        uint64_t cr4 = rcr4();
+        lcr4(cr4 ^ CR4_PGE);
+        lcr4(cr4);
+    }
+}
+
+/* Drops the TLB entries that may map VA in PML4, active or not. */
+static void tlb_invalidate(uint64_t *pml4, const void *va)
+{
+    unsigned pcid;
+
+    if (PTE_ADDR(rcr3()) == vtop(pml4))
+        invlpg((uint64_t)va);
+    else if (pcid_enabled && (pcid = pml4_pcid(pml4)) != 0)
+    {
+        if (invpcid_usable)
+            invpcid(INVPCID_ADDR, pcid, (uint64_t)va);
+        else
+            pml4[PML4_PCID_SLOT] = 0;
+    }
+}
+
+#ifdef USERPROG
+/* Drops every TLB entry that may map a user address in PML4, active
+ * or not. */
+static void tlb_flush_pml4(uint64_t *pml4)
+{
+    enum intr_level old_level = intr_disable();
+    unsigned pcid = pcid_enabled ? pml4_pcid(pml4) : 0;
+
+    if (pcid != 0 && invpcid_usable)
+        invpcid(INVPCID_CONTEXT, pcid, 0);
+    else if (PTE_ADDR(rcr3()) == vtop(pml4))
+    {
+        /* Without CR3_NOFLUSH, loading CR3 flushes the PCID it
+         * loads, or everything but global pages. */
+        lcr3(vtop(pml4) | pcid);
+    } else if (pcid != 0)
+        pml4[PML4_PCID_SLOT] = 0;
+    intr_set_level(old_level);
+}
+
+/* TLB gathering.
+ *
+ * Between tlb_gather_begin() and tlb_gather_finish(), the running
+ * thread's pml4_clear_page() calls on the gathered pml4 only clear the
+ * PTE and note the address.  tlb_gather_finish() then invalidates the
+ * addresses all at once, or flushes the pml4's entries outright if
+ * there were more than TLB_GATHER_MAX of them.  This is safe because
+ * the pml4's process runs no user code until the gather finishes, and
+ * only its user code would use the stale entries; so a cleared page's
+ * frame may be freed before the flush.  With one CPU there is nobody
+ * else to tell. */
+void tlb_gather_begin(struct tlb_gather *tlb, uint64_t *pml4)
+{
+    struct thread *t = thread_current();
+
+    ASSERT(t->tlb_gather == NULL);
+    tlb->pml4 = pml4;
+    tlb->cnt = 0;
+    t->tlb_gather = tlb;
+}
+
+/* Flushes the TLB entries that TLB has gathered and ends the gather. */
+void tlb_gather_finish(struct tlb_gather *tlb)
+{
+    struct thread *t = thread_current();
+
+    ASSERT(t->tlb_gather == tlb);
+    t->tlb_gather = NULL;
+    if (tlb->cnt > TLB_GATHER_MAX)
+        tlb_flush_pml4(tlb->pml4);
+    else
+        for (size_t i = 0; i < tlb->cnt; i++)
+            tlb_invalidate(tlb->pml4, tlb->va[i]);
+}
+#endif
+
+/* Invalidates the TLB entry for VA in PML4 now, or leaves it to the
+ * running thread's gather on PML4. */
+static void tlb_defer(uint64_t *pml4, void *va)
+{
+#ifdef USERPROG
+    struct tlb_gather *tlb = thread_current()->tlb_gather;
+
+    if (tlb != NULL && tlb->pml4 == pml4)
+    {
+        if (tlb->cnt < TLB_GATHER_MAX)
+            tlb->va[tlb->cnt] = va;
+        if (tlb->cnt <= TLB_GATHER_MAX)
+            tlb->cnt++;
+        return;
+    }
+#endif
+    tlb_invalidate(pml4, va);
+}
+
+/* Page-table page cache.
+ *
+ * Address spaces come and go with every exec() and exit(), so page
+ * table pages freed by pml4_destroy() are kept for the next ones
+ * instead of going back to the page allocator.  Page-table pages are
+ * kept zeroed, and pml4 pages with nothing but the kernel's entries,
+ * so that neither needs to be set up again.  Each cache is a stack
+ * linked through the first entry of its pages, which is zero in use. */
+#define PT_CACHE_MAX 64   /* Most page-table pages to keep. */
+#define PML4_CACHE_MAX 16 /* Most pml4 pages to keep. */
+
+static uint64_t *pt_cache;   /* Zeroed page-table pages. */
+static size_t pt_cache_cnt;
+static uint64_t *pml4_cache; /* Pml4 pages with only kernel mappings. */
+static size_t pml4_cache_cnt;
+
+/* Zeroed page-table pages set aside for splitting huge pages, one for
+ * each user huge page mapped, so that a split never has to allocate. */
+static uint64_t *pt_reserve;
+static size_t pt_reserve_cnt;
+
+/* Pops a page off *CACHE, which holds *CNT pages, and returns it with
+ * its first entry zeroed.  Returns NULL if the cache is empty. */
+static uint64_t *cache_pop(uint64_t **cache, size_t *cnt)
+{
+    enum intr_level old_level = intr_disable();
+    uint64_t *page = *cache;
+
+    if (page != NULL)
+    {
+        *cache = (uint64_t *)page[0];
+        page[0] = 0;
+        (*cnt)--;
+    }
+    intr_set_level(old_level);
+    return page;
+}
+
+/* Pushes PAGE onto *CACHE, which holds *CNT pages, if it holds fewer
+ * than MAX.  Returns false if it was full. */
+static bool cache_push(uint64_t **cache, size_t *cnt, size_t max, uint64_t *page)
+{
+    enum intr_level old_level = intr_disable();
+    bool pushed = *cnt < max;
+
+    if (pushed)
+    {
+        page[0] = (uint64_t)*cache;
+        *cache = page;
+        (*cnt)++;
+    }
+    intr_set_level(old_level);
+    return pushed;
+}
+
+/* Returns a zeroed page for a page table, or NULL if memory is out. */
+static uint64_t *pt_alloc(void)
+{
+    uint64_t *pt = cache_pop(&pt_cache, &pt_cache_cnt);
+    return pt != NULL ? pt : palloc_get_page(PAL_ZERO);
+}
+
+/* Frees page-table page PT, which must be all zeros unless DIRTY.  It
+ * is only zeroed if the cache will keep it. */
+static void pt_free(uint64_t *pt, bool dirty)
+{
+    if (pt_cache_cnt < PT_CACHE_MAX)
+    {
+        if (dirty)
+            memset(pt, 0, PGSIZE);
+        if (cache_push(&pt_cache, &pt_cache_cnt, PT_CACHE_MAX, pt))
+            return;
+    }
+    palloc_free_page(pt);
+}
+
 static uint64_t *pgdir_walk(uint64_t *pdp, const uint64_t va, int create)
 {
     int idx = PDX(va);
@@ -18,7 +259,7 @@ static uint64_t *pgdir_walk(uint64_t *pdp, const uint64_t va, int create)
         {
             if (create)
             {
-                uint64_t *new_page = palloc_get_page(PAL_ZERO);
+                uint64_t *new_page = pt_alloc();
                 if (new_page)
                     pdp[idx] = vtop(new_page) | PTE_U | PTE_W | PTE_P;
                 else
@@ -26,6 +267,9 @@ static uint64_t *pgdir_walk(uint64_t *pdp, const uint64_t va, int create)
             } else
                 return NULL;
         }
+        /* A huge page's PDE is the entry for every address in it. */
+        if (pdp[idx] & PTE_PS)
+            return &pdp[idx];
         return (uint64_t *)ptov(PTE_ADDR(pdp[idx]) + 8 * PTX(va));
     }
     return NULL;
@@ -43,7 +287,7 @@ static uint64_t *pdpe_walk(uint64_t *pdpe, const uint64_t va, int create)
         {
             if (create)
             {
-                uint64_t *new_page = palloc_get_page(PAL_ZERO);
+                uint64_t *new_page = pt_alloc();
                 if (new_page)
                 {
                     pdpe[idx] = vtop(new_page) | PTE_U | PTE_W | PTE_P;
@@ -57,7 +301,7 @@ static uint64_t *pdpe_walk(uint64_t *pdpe, const uint64_t va, int create)
     }
     if (pte == NULL && allocated)
     {
-        palloc_free_page((void *)ptov(PTE_ADDR(pdpe[idx])));
+        pt_free(ptov(PTE_ADDR(pdpe[idx])), false);
         pdpe[idx] = 0;
     }
     return pte;
@@ -81,7 +325,7 @@ uint64_t *pml4e_walk(uint64_t *pml4e, const uint64_t va, int create)
         {
             if (create)
             {
-                uint64_t *new_page = palloc_get_page(PAL_ZERO);
+                uint64_t *new_page = pt_alloc();
                 if (new_page)
                 {
                     pml4e[idx] = vtop(new_page) | PTE_U | PTE_W | PTE_P;
@@ -95,19 +339,81 @@ uint64_t *pml4e_walk(uint64_t *pml4e, const uint64_t va, int create)
     }
     if (pte == NULL && allocated)
     {
-        palloc_free_page((void *)ptov(PTE_ADDR(pml4e[idx])));
+        pt_free(ptov(PTE_ADDR(pml4e[idx])), false);
         pml4e[idx] = 0;
     }
     return pte;
 }
 
+/* Returns the address of the page-directory entry for virtual
+ * address VA in PML4, the entry that maps a huge page.  If PML4
+ * lacks the tables above it, behavior depends on CREATE, as in
+ * pml4e_walk(). */
+uint64_t *pml4_pde_walk(uint64_t *pml4, const uint64_t va, int create)
+{
+    uint64_t *table = pml4;
+    int idx[2] = {PML4(va), PDPE(va)};
+
+    for (int level = 0; level < 2; level++)
+    {
+        uint64_t *entry = &table[idx[level]];
+        if (!(*entry & PTE_P))
+        {
+            uint64_t *new_page;
+            if (!create || (new_page = pt_alloc()) == NULL)
+                return NULL;
+            *entry = vtop(new_page) | PTE_U | PTE_W | PTE_P;
+        }
+        table = ptov(PTE_ADDR(*entry));
+    }
+    return &table[PDX(va)];
+}
+
+/* Replaces the huge page entry *PDE, which maps VA in PML4, with a
+ * page table that maps the same memory with the same permissions one
+ * page at a time, so that a single page of it can change.  The page
+ * table comes from the reserve pml4_set_huge_page() filled.  The new
+ * entries start out clean and not accessed: the huge page's bits say
+ * nothing about which of its pages were touched. */
+static void pde_split(uint64_t *pml4, uint64_t *pde, const uint64_t va)
+{
+    uint64_t *pt = cache_pop(&pt_reserve, &pt_reserve_cnt);
+    uint64_t pa = HPTE_ADDR(*pde);
+    uint64_t flags = *pde & PTE_FLAGS & ~(PTE_PS | PTE_D | PTE_A);
+
+    ASSERT(pt != NULL);
+
+    for (unsigned i = 0; i < HPGCNT; i++)
+        pt[i] = (pa + i * PGSIZE) | flags;
+    *pde = vtop(pt) | PTE_U | PTE_W | PTE_P;
+    tlb_invalidate(pml4, (void *)va);
+}
+
+/* Like pml4e_walk() without CREATE, but splits a huge page at VA
+ * first, so that the entry returned maps VA's page alone. */
+static uint64_t *pte_walk_split(uint64_t *pml4, const void *va)
+{
+    uint64_t *pte = pml4e_walk(pml4, (uint64_t)va, false);
+
+    if (pte != NULL && (*pte & PTE_PS))
+    {
+        pde_split(pml4, pte, (uint64_t)va);
+        pte = pml4e_walk(pml4, (uint64_t)va, false);
+    }
+    return pte;
+}
+
 /* Creates a new page map level 4 (pml4) has mappings for kernel
  * virtual addresses, but none for user virtual addresses.
  * Returns the new page directory, or a null pointer if memory
  * allocation fails. */
 uint64_t *pml4_create(void)
 {
-    uint64_t *pml4 = palloc_get_page(0);
+    uint64_t *pml4 = cache_pop(&pml4_cache, &pml4_cache_cnt);
+    if (pml4 != NULL)
+        return pml4;
+
+    pml4 = palloc_get_page(0);
     if (pml4)
         memcpy(pml4, base_pml4, PGSIZE);
     return pml4;
@@ -136,8 +442,16 @@ static bool pgdir_for_each(uint64_t *pdp, pte_for_each_func *func, void *aux, un
     {
         uint64_t *pte = ptov((uint64_t *)pdp[i]);
         if (((uint64_t)pte) & PTE_P)
-            if (!pt_for_each((uint64_t *)PTE_ADDR(pte), func, aux, pml4_index, pdp_index, i))
+        {
+            if (pdp[i] & PTE_PS)
+            {
+                void *va = (void *)(((uint64_t)pml4_index << PML4SHIFT) | ((uint64_t)pdp_index << PDPESHIFT) |
+                                    ((uint64_t)i << PDXSHIFT));
+                if (!func(&pdp[i], va, aux))
+                    return false;
+            } else if (!pt_for_each((uint64_t *)PTE_ADDR(pte), func, aux, pml4_index, pdp_index, i))
                 return false;
+        }
     }
     return true;
 }
@@ -175,7 +489,7 @@ static void pt_destroy(uint64_t *pt)
         if (((uint64_t)pte) & PTE_P)
             palloc_free_page((void *)PTE_ADDR(pte));
     }
-    palloc_free_page((void *)pt);
+    pt_free(pt, true);
 }
 
 static void pgdir_destroy(uint64_t *pdp)
@@ -184,9 +498,18 @@ static void pgdir_destroy(uint64_t *pdp)
     {
         uint64_t *pte = ptov((uint64_t *)pdp[i]);
         if (((uint64_t)pte) & PTE_P)
-            pt_destroy(PTE_ADDR(pte));
+        {
+            if (pdp[i] & PTE_PS)
+            {
+                /* The huge page was never split, so its page table
+                 * is still in the reserve. */
+                palloc_free_multiple(ptov(HPTE_ADDR(pdp[i])), HPGCNT);
+                pt_free(cache_pop(&pt_reserve, &pt_reserve_cnt), false);
+            } else
+                pt_destroy(PTE_ADDR(pte));
+        }
     }
-    palloc_free_page((void *)pdp);
+    pt_free(pdp, true);
 }
 
 static void pdpe_destroy(uint64_t *pdpe)
@@ -197,7 +520,7 @@ static void pdpe_destroy(uint64_t *pdpe)
         if (((uint64_t)pde) & PTE_P)
             pgdir_destroy((void *)PTE_ADDR(pde));
     }
-    palloc_free_page((void *)pdpe);
+    pt_free(pdpe, true);
 }
 
 /* Destroys pml4e, freeing all the pages it references. */
@@ -211,14 +534,49 @@ void pml4_destroy(uint64_t *pml4)
     uint64_t *pdpe = ptov((uint64_t *)pml4[0]);
     if (((uint64_t)pdpe) & PTE_P)
         pdpe_destroy((void *)PTE_ADDR(pdpe));
-    palloc_free_page((void *)pml4);
+
+    /* The PCID is never handed out again in this generation, so its
+     * stale entries are harmless; evict them early if that is cheap. */
+    unsigned pcid = pml4_pcid(pml4);
+    if (pcid != 0 && invpcid_usable)
+        invpcid(INVPCID_CONTEXT, pcid, 0);
+
+    /* What is left is the kernel's half, as pml4_create() made it. */
+    pml4[0] = 0;
+    pml4[PML4_PCID_SLOT] = 0;
+    if (!cache_push(&pml4_cache, &pml4_cache_cnt, PML4_CACHE_MAX, pml4))
+        palloc_free_page((void *)pml4);
 }
 
 /* Loads page directory PD into the CPU's page directory base
  * register. */
 void pml4_activate(uint64_t *pml4)
 {
-    lcr3(vtop(pml4 ? pml4 : base_pml4));
+    enum intr_level old_level;
+    unsigned pcid = 0;
+
+    if (pml4 == NULL)
+        pml4 = base_pml4;
+    if (!pcid_enabled)
+    {
+        lcr3(vtop(pml4));
+        return;
+    }
+
+    old_level = intr_disable();
+    if (pml4 != base_pml4 && (pcid = pml4_pcid(pml4)) == 0)
+    {
+        if (pcid_next == PCID_CNT)
+        {
+            pcid_gen++;
+            pcid_next = 1;
+            tlb_flush_all();
+        }
+        pcid = pcid_next++;
+        pml4[PML4_PCID_SLOT] = PCID_ENTRY(pcid_gen, pcid);
+    }
+    lcr3(vtop(pml4) | pcid | CR3_NOFLUSH);
+    intr_set_level(old_level);
 }
 
 /* Looks up the physical address that corresponds to user virtual
@@ -232,7 +590,11 @@ void *pml4_get_page(uint64_t *pml4, const void *uaddr)
     uint64_t *pte = pml4e_walk(pml4, (uint64_t)uaddr, 0);
 
     if (pte && (*pte & PTE_P))
+    {
+        if (*pte & PTE_PS)
+            return ptov(HPTE_ADDR(*pte)) + ((uint64_t)uaddr & (HPGSIZE - 1));
         return ptov(PTE_ADDR(*pte)) + pg_ofs(uaddr);
+    }
     return NULL;
 }
 
@@ -253,14 +615,63 @@ bool pml4_set_page(uint64_t *pml4, void *upage, void *kpage, bool rw)
 
     uint64_t *pte = pml4e_walk(pml4, (uint64_t)upage, 1);
 
+    /* UPAGE lies in a huge page, so it is mapped already. */
+    if (pte && (*pte & PTE_PS))
+        return false;
     if (pte)
+    {
+        bool was_present = (*pte & PTE_P) != 0;
+
         *pte = vtop(kpage) | PTE_P | (rw ? PTE_W : 0) | PTE_U;
+        if (was_present)
+            tlb_invalidate(pml4, upage);
+    }
     return pte != NULL;
 }
 
+/* Adds a mapping in PML4 from the huge page at user virtual address
+ * UPAGE to the HPGSIZE bytes of physical memory at kernel virtual
+ * address KPAGE, with a single page-directory entry.  Both must be
+ * HPGSIZE aligned, physically in KPAGE's case.  Nothing in the huge
+ * page may be mapped already.  A page table is set aside for splitting
+ * the huge page later: the empty one left there, if any, or else a new
+ * one.  If WRITABLE is true, the memory is read/write; otherwise it
+ * is read-only.  Returns true if successful, false if memory
+ * allocation failed or part of UPAGE's range is mapped. */
+bool pml4_set_huge_page(uint64_t *pml4, void *upage, void *kpage, bool rw)
+{
+    ASSERT((uint64_t)upage % HPGSIZE == 0);
+    ASSERT(vtop(kpage) % HPGSIZE == 0);
+    ASSERT(is_user_vaddr(upage + HPGSIZE - 1));
+    ASSERT(pml4 != base_pml4);
+
+    uint64_t *pde = pml4_pde_walk(pml4, (uint64_t)upage, 1);
+    uint64_t *pt;
+
+    if (pde == NULL)
+        return false;
+    if (*pde & PTE_P)
+    {
+        pt = ptov(PTE_ADDR(*pde));
+        if (*pde & PTE_PS)
+            return false;
+        for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++)
+            if (pt[i] & PTE_P)
+                return false;
+        memset(pt, 0, PGSIZE);
+    } else if ((pt = pt_alloc()) == NULL)
+        return false;
+    cache_push(&pt_reserve, &pt_reserve_cnt, SIZE_MAX, pt);
+    *pde = vtop(kpage) | PTE_P | PTE_PS | (rw ? PTE_W : 0) | PTE_U;
+    /* The CPU may still cache the page table just freed. */
+    tlb_invalidate(pml4, upage);
+    return true;
+}
+
 /* Marks user virtual page UPAGE "not present" in page
  * directory PD.  Later accesses to the page will fault.  Other
- * bits in the page table entry are preserved.
+ * bits in the page table entry are preserved.  A huge page that
+ * UPAGE lies in is split first, so that the rest of it stays mapped.
  * UPAGE need not be mapped. */
 void pml4_clear_page(uint64_t *pml4, void *upage)
 {
@@ -268,19 +679,18 @@ void pml4_clear_page(uint64_t *pml4, void *upage)
     ASSERT(pg_ofs(upage) == 0);
     ASSERT(is_user_vaddr(upage));
 
-    pte = pml4e_walk(pml4, (uint64_t)upage, false);
+    pte = pte_walk_split(pml4, upage);
 
     if (pte != NULL && (*pte & PTE_P) != 0)
     {
         *pte &= ~PTE_P;
-        if (rcr3() == vtop(pml4))
-            invlpg((uint64_t)upage);
+        tlb_defer(pml4, upage);
     }
 }
 
 /* Returns true if the PTE for virtual page VPAGE in PML4 is dirty,
  * that is, if the page has been modified since the PTE was
- * installed.
+ * installed.  Within a huge page, reports the huge page as a whole.
  * Returns false if PML4 contains no PTE for VPAGE. */
 bool pml4_is_dirty(uint64_t *pml4, const void *vpage)
 {
@@ -289,10 +699,10 @@ bool pml4_is_dirty(uint64_t *pml4, const void *vpage)
 }
 
 /* Set the dirty bit to DIRTY in the PTE for virtual page VPAGE
- * in PML4. */
+ * in PML4, splitting a huge page that VPAGE lies in. */
 void pml4_set_dirty(uint64_t *pml4, const void *vpage, bool dirty)
 {
-    uint64_t *pte = pml4e_walk(pml4, (uint64_t)vpage, false);
+    uint64_t *pte = pte_walk_split(pml4, vpage);
     if (pte)
     {
         if (dirty)
@@ -300,8 +710,7 @@ void pml4_set_dirty(uint64_t *pml4, const void *vpage, bool dirty)
         else
             *pte &= ~(uint32_t)PTE_D;
 
-        if (rcr3() == vtop(pml4))
-            invlpg((uint64_t)vpage);
+        tlb_invalidate(pml4, vpage);
     }
 }
 
@@ -316,7 +725,9 @@ bool pml4_is_accessed(uint64_t *pml4, const void *vpage)
 }
 
 /* Sets the accessed bit to ACCESSED in the PTE for virtual page
-   VPAGE in PD. */
+   VPAGE in PD.  Within a huge page, the bit is shared by all of its
+   pages; that is close enough for page replacement, so the huge page
+   is not split. */
 void pml4_set_accessed(uint64_t *pml4, const void *vpage, bool accessed)
 {
     uint64_t *pte = pml4e_walk(pml4, (uint64_t)vpage, false);
@@ -327,7 +738,6 @@ void pml4_set_accessed(uint64_t *pml4, const void *vpage, bool accessed)
         else
             *pte &= ~(uint32_t)PTE_A;
 
-        if (rcr3() == vtop(pml4))
-            invlpg((uint64_t)vpage);
+        tlb_invalidate(pml4, vpage);
     }
 }
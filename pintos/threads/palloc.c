@@ -300,6 +300,40 @@ void *palloc_get_multiple(enum palloc_flags flags, size_t page_cnt)
     return pages;
 }
 
+/* Like palloc_get_multiple(), but the pages returned start at a
+   physical address that is a multiple of ALIGN_CNT pages, as a 2 MiB
+   page frame must.  Returns a null pointer if no free run of
+   PAGE_CNT pages starts at such an address. */
+void *palloc_get_multiple_aligned(enum palloc_flags flags, size_t page_cnt, size_t align_cnt)
+{
+    struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+    size_t pool_pages = bitmap_size(pool->used_map);
+    size_t page_idx = (align_cnt - pg_no(vtop(pool->base)) % align_cnt) % align_cnt;
+    void *pages = NULL;
+
+    lock_acquire(&pool->lock);
+    for (; page_idx + page_cnt <= pool_pages; page_idx += align_cnt)
+        if (bitmap_none(pool->used_map, page_idx, page_cnt))
+        {
+            bitmap_set_multiple(pool->used_map, page_idx, page_cnt, true);
+            pages = pool->base + PGSIZE * page_idx;
+            break;
+        }
+    lock_release(&pool->lock);
+
+    if (pages)
+    {
+        if (flags & PAL_ZERO)
+            memset(pages, 0, PGSIZE * page_cnt);
+    } else
+    {
+        if (flags & PAL_ASSERT)
+            PANIC("palloc_get: out of pages");
+    }
+
+    return pages;
+}
+
 /* Obtains a single free page and returns its kernel virtual
    address.
    If PAL_USER is set, the page is obtained from the user pool,
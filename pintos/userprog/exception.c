@@ -4,11 +4,28 @@
 #include "userprog/gdt.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
+#include "threads/vaddr.h"
 #include "intrinsic.h"
 
 /* Number of page faults processed. */
 static long long page_fault_cnt;
 
+#ifdef VM
+/* Fault latency histograms have buckets for 2**FAULT_HIST_SHIFT
+   cycles or less, twice as many, and so on, up to the last bucket,
+   which holds the rest. */
+#define FAULT_HIST_SHIFT 9
+#define FAULT_HIST_BUCKETS 16
+
+/* Page faults by kind, with the cycles they took to handle. */
+static const char *fault_names[VM_FAULT_CNT] = {"minor", "major", "copy-on-write", "stack growth", "invalid"};
+static long long fault_cnt[VM_FAULT_CNT];
+static uint64_t fault_cycles[VM_FAULT_CNT];
+static long long fault_hist[VM_FAULT_CNT][FAULT_HIST_BUCKETS];
+
+static void fault_account(enum vm_fault kind, uint64_t cycles);
+#endif
+
 static void kill(struct intr_frame *);
 static void page_fault(struct intr_frame *);
 
@@ -61,7 +78,34 @@ void exception_init(void)
 void exception_print_stats(void)
 {
     printf("Exception: %lld page faults\n", page_fault_cnt);
+#ifdef VM
+    for (int kind = 0; kind < VM_FAULT_CNT; kind++)
+    {
+        if (fault_cnt[kind] == 0)
+            continue;
+        printf("  %s: %lld faults, %" PRIu64 " cycles on average\n", fault_names[kind], fault_cnt[kind],
+               fault_cycles[kind] / fault_cnt[kind]);
+        for (int b = 0; b < FAULT_HIST_BUCKETS; b++)
+            if (fault_hist[kind][b] != 0)
+                printf("    %s 2^%d cycles: %lld\n", b < FAULT_HIST_BUCKETS - 1 ? "<=" : "> ",
+                       FAULT_HIST_SHIFT + (b < FAULT_HIST_BUCKETS - 1 ? b : b - 1), fault_hist[kind][b]);
+    }
+#endif
+}
+
+#ifdef VM
+/* Records a fault of KIND that took CYCLES to handle. */
+static void fault_account(enum vm_fault kind, uint64_t cycles)
+{
+    int b = 0;
+
+    while (b < FAULT_HIST_BUCKETS - 1 && cycles > (1ULL << (FAULT_HIST_SHIFT + b)))
+        b++;
+    fault_cnt[kind]++;
+    fault_cycles[kind] += cycles;
+    fault_hist[kind][b]++;
 }
+#endif
 
 /* Handler for an exception (probably) caused by a user process. */
 static void kill(struct intr_frame *f)
@@ -118,6 +162,10 @@ static void page_fault(struct intr_frame *f)
     bool write;       /* True: access was write, false: access was read. */
     bool user;        /* True: access by user, false: access by kernel. */
     void *fault_addr; /* Fault address. */
+#ifdef VM
+    uint64_t start = rdtsc();
+    enum vm_fault kind;
+#endif
 
     /* Obtain faulting address, the virtual address that was
        accessed to cause the fault.  It may point to code or to
@@ -135,14 +183,24 @@ static void page_fault(struct intr_frame *f)
     write = (f->error_code & PF_W) != 0;
     user = (f->error_code & PF_U) != 0;
 
+    /* Count page faults. */
+    page_fault_cnt++;
+
 #ifdef VM
     /* For project 3 and later. */
-    if (vm_try_handle_fault(f, fault_addr, user, write, not_present))
+    kind = vm_try_handle_fault(f, fault_addr, user, write, not_present);
+    fault_account(kind, rdtsc() - start);
+    if (kind != VM_FAULT_INVALID)
         return;
-#endif
 
-    /* Count page faults. */
-    page_fault_cnt++;
+    /* A bad user access, whether by user code or by the kernel on the
+     * process's behalf, kills just the process. */
+    if (user || is_user_vaddr(fault_addr))
+    {
+        thread_current()->exit_code = -1;
+        thread_exit();
+    }
+#endif
 
     /* If the fault is true fault, show info and exit. */
     printf("Page fault at %p: %s error %s page in %s context.\n", fault_addr,
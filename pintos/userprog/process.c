@@ -13,7 +13,9 @@
 #include "threads/flags.h"
 #include "threads/init.h"
 #include "threads/interrupt.h"
+#include "threads/malloc.h"
 #include "threads/palloc.h"
+#include "threads/synch.h"
 #include "threads/thread.h"
 #include "threads/mmu.h"
 #include "threads/vaddr.h"
@@ -28,6 +30,18 @@ static void process_cleanup(void);
 static bool load(const char *file_name, struct intr_frame *if_);
 static void initd(void *f_name);
 static void __do_fork(void *);
+static void reaper(void *aux);
+
+/* Address spaces of dead processes, torn down by the reaper thread so
+ * that exit() and exec() need not wait for it. */
+struct reap_req {
+    struct list_elem elem;
+    uint64_t *pml4;
+};
+
+static struct list reap_queue;
+static struct lock reap_lock;
+static struct condition reap_ready; /* Signaled when a pml4 is queued. */
 
 /* General process initializer for initd and other process. */
 static void process_init(void)
@@ -35,6 +49,51 @@ static void process_init(void)
     struct thread *current = thread_current();
 }
 
+/* Starts the reaper thread. */
+void process_reaper_init(void)
+{
+    list_init(&reap_queue);
+    lock_init(&reap_lock);
+    cond_init(&reap_ready);
+    thread_create("reaper", PRI_DEFAULT, reaper, NULL);
+}
+
+/* Kernel thread that destroys the page tables of dead processes. */
+static void reaper(void *aux UNUSED)
+{
+    for (;;)
+    {
+        struct reap_req *req;
+
+        lock_acquire(&reap_lock);
+        while (list_empty(&reap_queue))
+            cond_wait(&reap_ready, &reap_lock);
+        req = list_entry(list_pop_front(&reap_queue), struct reap_req, elem);
+        lock_release(&reap_lock);
+
+        pml4_destroy(req->pml4);
+        free(req);
+    }
+}
+
+/* Hands PML4, which no thread has loaded, to the reaper, or destroys
+ * it right away if the request cannot be allocated. */
+static void reap_pml4(uint64_t *pml4)
+{
+    struct reap_req *req = malloc(sizeof *req);
+
+    if (req == NULL)
+    {
+        pml4_destroy(pml4);
+        return;
+    }
+    req->pml4 = pml4;
+    lock_acquire(&reap_lock);
+    list_push_back(&reap_queue, &req->elem);
+    cond_signal(&reap_ready, &reap_lock);
+    lock_release(&reap_lock);
+}
+
 /* Starts the first userland program, called "initd", loaded from FILE_NAME.
  * The new thread may be scheduled (and may even exit)
  * before process_create_initd() returns. Returns the initd's
@@ -229,7 +288,9 @@ static void process_cleanup(void)
     struct thread *curr = thread_current();
 
 #ifdef VM
-    supplemental_page_table_kill(&curr->spt);
+    /* Kernel threads never set up a supplemental page table. */
+    if (curr->pml4 != NULL)
+        supplemental_page_table_kill(&curr->spt);
 #endif
 
     uint64_t *pml4;
@@ -247,7 +308,7 @@ static void process_cleanup(void)
          * that's been freed (and cleared). */
         curr->pml4 = NULL;
         pml4_activate(NULL);
-        pml4_destroy(pml4);
+        reap_pml4(pml4);
     }
 }
 
@@ -361,7 +422,9 @@ static bool load(const char *file_name, struct intr_frame *if_)
     }
     //  ========================
     /* Open executable file. */
+    lock_acquire(&filesys_lock);
     file = filesys_open(file_name);
+    lock_release(&filesys_lock);
     if (file == NULL)
     {
         printf("load: %s: open failed\n", file_name);
@@ -490,7 +553,9 @@ static bool load(const char *file_name, struct intr_frame *if_)
 
 done:
     /* We arrive here whether the load is successful or not. */
+    lock_acquire(&filesys_lock);
     file_close(file);
+    lock_release(&filesys_lock);
     return success;
 }
 
@@ -645,11 +710,20 @@ static bool install_page(void *upage, void *kpage, bool writable)
  * If you want to implement the function for only project 2, implement it on the
  * upper block. */
 
+/* Loads PAGE's part of a segment, as described by AUX, a struct
+ * file_page, on the page's first fault. */
 static bool lazy_load_segment(struct page *page, void *aux)
 {
-    /* TODO: Load the segment from the file */
-    /* TODO: This called when the first page fault occurs on address VA. */
-    /* TODO: VA is available when calling this function. */
+    struct file_page *seg = aux;
+    void *kva = page->frame->kva;
+    bool success;
+
+    lock_acquire(&filesys_lock);
+    success = file_read_at(seg->file, kva, seg->read_bytes, seg->ofs) == (off_t)seg->read_bytes;
+    lock_release(&filesys_lock);
+    memset(kva + seg->read_bytes, 0, PGSIZE - seg->read_bytes);
+    file_page_free(seg);
+    return success;
 }
 
 /* Loads a segment starting at offset OFS in FILE at address
@@ -681,15 +755,29 @@ static bool load_segment(struct file *file, off_t ofs, uint8_t *upage, uint32_t
         size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
         size_t page_zero_bytes = PGSIZE - page_read_bytes;
 
-        /* TODO: Set up aux to pass information to the lazy_load_segment. */
-        void *aux = NULL;
-        if (!vm_alloc_page_with_initializer(VM_ANON, upage, writable, lazy_load_segment, aux))
+        struct file_page *aux = malloc(sizeof *aux);
+        if (aux == NULL)
             return false;
+        aux->file = file_reopen(file);
+        if (aux->file == NULL)
+        {
+            free(aux);
+            return false;
+        }
+        aux->ofs = ofs;
+        aux->read_bytes = page_read_bytes;
+        aux->map_addr = NULL;
+        if (!vm_alloc_page_with_initializer(VM_ANON | VM_TEXT, upage, writable, lazy_load_segment, aux))
+        {
+            file_page_free(aux);
+            return false;
+        }
 
         /* Advance. */
         read_bytes -= page_read_bytes;
         zero_bytes -= page_zero_bytes;
         upage += PGSIZE;
+        ofs += page_read_bytes;
     }
     return true;
 }
@@ -700,11 +788,12 @@ static bool setup_stack(struct intr_frame *if_)
     bool success = false;
     void *stack_bottom = (void *)(((uint8_t *)USER_STACK) - PGSIZE);
 
-    /* TODO: Map the stack on stack_bottom and claim the page immediately.
-     * TODO: If success, set the rsp accordingly.
-     * TODO: You should mark the page is stack. */
-    /* TODO: Your code goes here */
-
+    if (vm_alloc_page(VM_ANON | VM_STACK, stack_bottom, true) && vm_claim_page(stack_bottom))
+    {
+        thread_current()->spt.stack_bottom = stack_bottom;
+        if_->rsp = USER_STACK;
+        success = true;
+    }
     return success;
 }
 #endif /* VM */
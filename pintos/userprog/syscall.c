@@ -14,6 +14,9 @@
 #include "threads/synch.h"
 #include "userprog/process.h"
 #include "threads/palloc.h"
+#ifdef VM
+#include "vm/vm.h"
+#endif
 
 #define FD_MIN 2
 #define FD_MAX 128
@@ -30,12 +33,21 @@ static int sys_filesize(int fd);                                   // 완료
 static int sys_read(int fd, void *buffer, unsigned length);        // 완료
 static int sys_write(int fd, const void *buffer, unsigned length); // 완료
 static void sys_close(int fd);                                     // 완료
+#ifdef VM
+static void *sys_mmap(void *addr, size_t length, int writable, int fd, off_t offset);
+static void sys_munmap(void *addr);
+static int sys_madvise(void *addr, size_t length, int advice);
+static bool sys_memstat(struct memstat *st);
+#endif
 // helper 함수들 ========
 void check_valid_addr(void *addr);
+static bool is_valid_str_page(const char *str);
+static char *copy_user_str(const char *str);
+static void pin_buffer(void *buffer, unsigned length, bool write);
+static void unpin_buffer(void *buffer, unsigned length);
 static int create_fd(struct file *f);
 static struct file *get_file_from_fd(int fd);
 
-static struct lock file_lock;
 /* System call.
  *
  * Previously system call services was handled by the interrupt handler
@@ -58,7 +70,6 @@ void syscall_init(void)
      * until the syscall_entry swaps the userland stack to the kernel
      * mode stack. Therefore, we masked the FLAG_FL. */
     write_msr(MSR_SYSCALL_MASK, FLAG_IF | FLAG_TF | FLAG_DF | FLAG_IOPL | FLAG_AC | FLAG_NT);
-    lock_init(&file_lock);
 }
 
 /* The main system call interface */
@@ -66,6 +77,10 @@ void syscall_handler(struct intr_frame *if_ UNUSED)
 {
     // 1) syscall 번호 받기 ========
     uint64_t syscall_no = if_->R.rax;
+#ifdef VM
+    // 커널 모드에서 유저 스택 page fault 나면 stack growth 판단에 씀
+    thread_current()->user_rsp = if_->rsp;
+#endif
     int fd;
     int status;
     void *buffer;
@@ -127,6 +142,28 @@ void syscall_handler(struct intr_frame *if_ UNUSED)
             sys_close(fd);
             break;
 
+#ifdef VM
+        case SYS_MMAP:
+            if_->R.rax = (uint64_t)sys_mmap((void *)if_->R.rdi, if_->R.rsi, if_->R.rdx, if_->R.r10, if_->R.r8);
+            break;
+
+        case SYS_MUNMAP:
+            sys_munmap((void *)if_->R.rdi);
+            break;
+
+        case SYS_MADVISE:
+            if_->R.rax = sys_madvise((void *)if_->R.rdi, if_->R.rsi, if_->R.rdx);
+            break;
+
+        case SYS_MEMSTAT:
+            if_->R.rax = sys_memstat((struct memstat *)if_->R.rdi);
+            break;
+
+        case SYS_RSS_LIMIT:
+            vm_set_rss_limit(if_->R.rdi);
+            break;
+#endif
+
         default:
             sys_exit(-1);
             break;
@@ -150,28 +187,30 @@ static void sys_exit(int status)
 // create(): 디스크에 파일의 inode(메타데이터)와 데이터 블록 공간을 영구적으로 할당한다.
 static bool sys_create(const char *file, unsigned initial_size)
 {
-    check_valid_addr(file);
-    if (file == NULL)
-    {
-        return false;
-    }
-    lock_acquire(&file_lock);
-    bool is_created = filesys_create(file, initial_size);
-    lock_release(&file_lock);
+    char *kfile = copy_user_str(file);
+
+    lock_acquire(&filesys_lock);
+    bool is_created = filesys_create(kfile, initial_size);
+    lock_release(&filesys_lock);
 
+    palloc_free_page(kfile);
     return is_created;
 }
 
 static int sys_open(const char *file)
 {
-    check_valid_addr(file);
+    char *kfile = copy_user_str(file);
 
-    if (*file == '\0')
+    if (*kfile == '\0')
+    {
+        palloc_free_page(kfile);
         return -1;
+    }
 
-    lock_acquire(&file_lock);
-    struct file *open_file = filesys_open(file);
-    lock_release(&file_lock);
+    lock_acquire(&filesys_lock);
+    struct file *open_file = filesys_open(kfile);
+    lock_release(&filesys_lock);
+    palloc_free_page(kfile);
 
     if (open_file == NULL)
     {
@@ -201,6 +240,11 @@ static int sys_read(int fd, void *buffer, unsigned length)
         check_valid_addr(buffer + length);
 
     uint8_t *buf = (uint8_t *)buffer; // [!] void타입 포인터는 사이즈 알 수 없어 값 넣기/수정불가
+    int result;
+
+    if (fd == 1) // 쓰기 전용
+        return -1;
+    pin_buffer(buffer, length, true);
 
     if (fd == 0) // 키보드
     {
@@ -209,52 +253,57 @@ static int sys_read(int fd, void *buffer, unsigned length)
             uint8_t key = input_getc();
             buf[i] = key;
         }
-        return length;
+        result = length;
 
-    } else if (fd == 1) // 쓰기 전용
-    {
-        return -1;
     } else
     {
         // 1) 파일 불러오기
         struct file *f = get_file_from_fd(fd);
         if (f == NULL)
         {
-            return -1;
+            result = -1;
+        } else
+        {
+            // 2) length만큼 읽기 (file --> buffer)
+            lock_acquire(&filesys_lock);
+            result = file_read(f, buffer, (int)length); // 읽은 바이트수 반환
+            lock_release(&filesys_lock);
         }
-        // 2) length만큼 읽기 (file --> buffer)
-        lock_acquire(&file_lock);
-        off_t read_bytes = file_read(f, buffer, (int)length); // 읽은 바이트수 반환
-        lock_release(&file_lock);
-        return (int)read_bytes;
     }
+    unpin_buffer(buffer, length);
+    return result;
 }
 
 // write(): 열려 있는 파일(fd) 에 대해 buffer로부터 size 바이트만큼 데이터를 쓴다.
 static int sys_write(int fd, const void *buffer, unsigned length)
 {
     check_valid_addr(buffer);
+    int result;
 
     if (fd == 0) // 읽기 전용
-    {
         return -1;
-    } else if (fd == 1)
+    pin_buffer((void *)buffer, length, false);
+
+    if (fd == 1)
     {
         putbuf((const char *)buffer, (size_t)length);
-        return length; // 수백바이트 이상이면 한번의 putbuf호출로 전체 버퍼 출력해야하는데
-                       //  그거 구현 어떻게해야할지
+        result = length; // 수백바이트 이상이면 한번의 putbuf호출로 전체 버퍼 출력해야하는데
+                         //  그거 구현 어떻게해야할지
     } else
     {
         struct file *f = get_file_from_fd(fd);
         if (f == NULL)
         {
-            return -1;
+            result = -1;
+        } else
+        {
+            lock_acquire(&filesys_lock);
+            result = file_write(f, buffer, length); // file_write(): 쓰인 바이트수만 반환
+            lock_release(&filesys_lock);
         }
-        lock_acquire(&file_lock);
-        off_t len = file_write(f, buffer, length); // file_write(): 쓰인 바이트수만 반환
-        lock_release(&file_lock);
-        return len;
     }
+    unpin_buffer((void *)buffer, length);
+    return result;
     // 추가사항: 권한 확인(쓰기가능파일인지), 콘솔 출력시, size>=1000Byte면 여러번 나눠서 출력하도록,
 }
 
@@ -268,22 +317,123 @@ static void sys_close(int fd)
         sys_exit(-1);
     }
     // 3) file_close() -> fd 비우기
-    lock_acquire(&file_lock);
+    lock_acquire(&filesys_lock);
     file_close(fdt[fd]);
-    lock_release(&file_lock);
+    lock_release(&filesys_lock);
     fdt[fd] = NULL;
 }
 
+#ifdef VM
+// mmap(): fd의 파일을 addr부터 length만큼 매핑 (writable에 MAP_POPULATE면 미리 다 읽어옴)
+static void *sys_mmap(void *addr, size_t length, int writable, int fd, off_t offset)
+{
+    struct file *f = get_file_from_fd(fd);
+    if (f == NULL)
+    {
+        return MAP_FAILED;
+    }
+    // do_mmap()/do_munmap()은 파일 I/O마다 filesys_lock을 직접 잡음 (MAP_POPULATE, 쓰기 반영)
+    return do_mmap(addr, length, writable, f, offset);
+}
+
+static void sys_munmap(void *addr)
+{
+    do_munmap(addr);
+}
+
+// madvise(): addr부터 length만큼의 접근 패턴 힌트 전달 (성공 0, 실패 -1)
+static int sys_madvise(void *addr, size_t length, int advice)
+{
+    return vm_madvise(addr, length, advice) ? 0 : -1;
+}
+
+// memstat(): 현재 프로세스의 RSS, 워킹셋, 페이지 폴트 수를 st에 채워줌
+static bool sys_memstat(struct memstat *st)
+{
+    struct memstat kst;
+
+    // 커널의 쓰기는 읽기 전용 PTE에서 폴트가 안 나므로, 공유 프레임(zero/KSM/text)이나
+    // 코드 페이지를 덮어쓰지 않게 sys_read처럼 쓰기용으로 고정(unshare 또는 거부)한 뒤 복사
+    check_valid_addr(st);
+    vm_memstat(&kst);
+    pin_buffer(st, sizeof *st, true);
+    *st = kst;
+    unpin_buffer(st, sizeof *st);
+    return true;
+}
+#endif
+
 // helper 함수들 =============================================
 void check_valid_addr(void *addr) // 유효한 주소인지 확인 후 처리
 {
     // 1) 주소값이 NULL은 아닌지 2)주소가 유저가상메모리영역인지 3)p_table에 존재하는지
+#ifdef VM
+    // VM에선 3)을 vm_pin_user()/page fault가 대신함 (lazy 페이지 로드, 스택 확장까지 해줌)
+    if (addr == NULL || !is_user_vaddr(addr))
+#else
     if (addr == NULL || !is_user_vaddr(addr) || pml4_get_page(thread_current()->pml4, addr) == NULL)
+#endif
     {
         sys_exit(-1);
     }
 }
 
+// 문자열 인자의 str이 든 페이지를 읽어도 되는지 확인
+// VM에선 spt에 있거나 폴트 나면 스택이 자랄 주소면 유효
+static bool is_valid_str_page(const char *str)
+{
+    if (str == NULL || !is_user_vaddr(str))
+        return false;
+#ifdef VM
+    return spt_find_page(&thread_current()->spt, (void *)str) != NULL || vm_is_stack_addr((void *)str);
+#else
+    return pml4_get_page(thread_current()->pml4, str) != NULL;
+#endif
+}
+
+// 유저 문자열을 커널 페이지로 복사 (복사 중 page fault, 스택 확장은 filesys_lock 잡기 전에 끝남)
+// 페이지마다 건드리기 전에 확인하고, 잘못된 주소면 kstr을 돌려준 뒤 종료 (커널 페이지 누수 방지)
+static char *copy_user_str(const char *str)
+{
+    char *kstr = palloc_get_page(0);
+    size_t i;
+
+    if (kstr == NULL)
+        sys_exit(-1);
+    for (i = 0; i < PGSIZE - 1; i++)
+    {
+        if ((i == 0 || pg_ofs(str + i) == 0) && !is_valid_str_page(str + i))
+        {
+            palloc_free_page(kstr);
+            sys_exit(-1);
+        }
+        if ((kstr[i] = str[i]) == '\0')
+            return kstr;
+    }
+    kstr[i] = '\0';
+    return kstr;
+}
+
+// buffer의 모든 페이지를 올려서 고정 (파일시스템 락 잡은 채로 page fault/eviction 안 나게)
+static void pin_buffer(void *buffer, unsigned length, bool write UNUSED)
+{
+#ifdef VM
+    if (!vm_pin_user(buffer, length, write))
+        sys_exit(-1);
+#else
+    // VM 없으면 페이지가 쫓겨나지 않으므로 범위 안 페이지가 다 매핑돼 있는지만 확인
+    for (void *p = pg_round_down(buffer); p < buffer + length; p += PGSIZE)
+        check_valid_addr(p < buffer ? buffer : p);
+#endif
+}
+
+static void unpin_buffer(void *buffer UNUSED, unsigned length UNUSED)
+{
+#ifdef VM
+    vm_unpin_user(buffer, length);
+#endif
+}
+
 static int create_fd(struct file *f) // 해당 파일용 fd를 만들어 fd_table에 저장
 {
     struct file **local_fdt = thread_current()->file_descriptor_table;
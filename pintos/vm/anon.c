@@ -1,7 +1,26 @@
 /* anon.c: Implementation of page for non-disk image (a.k.a. anonymous page). */
 
+#include <bitmap.h>
+#include <list.h>
+#include <stdio.h>
+#include <string.h>
 #include "vm/vm.h"
 #include "devices/disk.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Number of swap disk sectors that hold one page. */
+#define SECTORS_PER_SLOT (PGSIZE / DISK_SECTOR_SIZE)
+
+/* Compressed bytes zswap holds before it writes its oldest pages
+ * through to the swap disk. */
+#define ZSWAP_WATERMARK (128 * PGSIZE)
+
+/* Largest compressed page worth keeping in zswap.  A page that does
+ * not shrink below this goes straight to the swap disk. */
+#define ZSWAP_MAX_SIZE (PGSIZE * 3 / 4)
 
 /* DO NOT MODIFY BELOW LINE */
 static struct disk *swap_disk;
@@ -17,36 +36,363 @@ static const struct page_operations anon_ops = {
     .type = VM_ANON,
 };
 
+/* Swap slots in use, one bit per page-sized slot of SWAP_DISK. */
+static struct bitmap *swap_table;
+static struct lock swap_lock; /* Protects SWAP_TABLE, zswap, and anon_pages' swap state. */
+
+/* zswap: a pool of compressed anonymous pages in kernel memory, in
+ * front of the swap disk.  Evicted pages are compressed into the pool
+ * and reach the disk only when the pool passes ZSWAP_WATERMARK, oldest
+ * first. */
+struct zswap_entry {
+    struct list_elem elem; /* Element in ZSWAP_LRU. */
+    struct page *page;     /* Page whose contents these are. */
+    size_t size;           /* Bytes in DATA. */
+    uint8_t data[];        /* Compressed contents. */
+};
+
+static struct list zswap_lru;    /* Entries, oldest first. */
+static size_t zswap_bytes;       /* Compressed bytes in the pool. */
+static uint8_t *zswap_buf;       /* Scratch page for (de)compression. */
+static long long zswap_store_cnt;     /* Pages swapped out to the pool. */
+static long long zswap_hit_cnt;       /* Pages swapped in from the pool. */
+static long long zswap_writeback_cnt; /* Pages moved from the pool to disk. */
+static long long swap_read_cnt;       /* Pages swapped in from disk. */
+
+static size_t lz_compress(const uint8_t *src, uint8_t *dst, size_t dst_max);
+static void lz_decompress(const uint8_t *src, size_t src_size, uint8_t *dst);
+
 /* Initialize the data for anonymous pages */
 void vm_anon_init(void)
 {
-    /* TODO: Set up the swap_disk. */
-    swap_disk = NULL;
+    size_t slot_cnt = 0;
+
+    swap_disk = disk_get(1, 1);
+    if (swap_disk != NULL)
+        slot_cnt = disk_size(swap_disk) / SECTORS_PER_SLOT;
+    swap_table = bitmap_create(slot_cnt);
+    if (swap_table == NULL)
+        PANIC("swap table creation failed");
+    lock_init(&swap_lock);
+    list_init(&zswap_lru);
+    zswap_buf = palloc_get_page(PAL_ASSERT);
 }
 
 /* Initialize the file mapping */
-bool anon_initializer(struct page *page, enum vm_type type, void *kva)
+bool anon_initializer(struct page *page, enum vm_type type UNUSED, void *kva)
 {
+    /* A page with no initializer starts out zeroed.  Check before the
+     * union is overwritten. */
+    bool zero = page->uninit.init == NULL;
+
     /* Set up the handler */
     page->operations = &anon_ops;
 
     struct anon_page *anon_page = &page->anon;
+    anon_page->swap_slot = BITMAP_ERROR;
+    anon_page->zswap = NULL;
+    if (zero)
+        memset(kva, 0, PGSIZE);
+    return true;
+}
+
+/* Writes the page at KVA to a free swap slot and returns the slot,
+ * or BITMAP_ERROR if the swap disk is full.  Caller holds SWAP_LOCK. */
+static size_t swap_write(const void *kva)
+{
+    size_t slot = bitmap_scan_and_flip(swap_table, 0, 1, false);
+
+    if (slot != BITMAP_ERROR)
+        for (size_t i = 0; i < SECTORS_PER_SLOT; i++)
+            disk_write(swap_disk, slot * SECTORS_PER_SLOT + i, kva + i * DISK_SECTOR_SIZE);
+    return slot;
+}
+
+/* Removes E from the pool.  Caller holds SWAP_LOCK. */
+static void zswap_remove(struct zswap_entry *e)
+{
+    list_remove(&e->elem);
+    zswap_bytes -= e->size;
+    e->page->anon.zswap = NULL;
+}
+
+/* Writes the oldest pages in the pool through to the swap disk until
+ * the pool is back under its watermark or the disk is full.  Caller
+ * holds SWAP_LOCK. */
+static void zswap_shrink(void)
+{
+    while (zswap_bytes > ZSWAP_WATERMARK)
+    {
+        struct zswap_entry *e = list_entry(list_front(&zswap_lru), struct zswap_entry, elem);
+        size_t slot;
+
+        lz_decompress(e->data, e->size, zswap_buf);
+        slot = swap_write(zswap_buf);
+        if (slot == BITMAP_ERROR)
+            break;
+        zswap_remove(e);
+        e->page->anon.swap_slot = slot;
+        free(e);
+        zswap_writeback_cnt++;
+    }
 }
 
-/* Swap in the page by read contents from the swap disk. */
+/* Swap in the page from the compressed pool, or else by reading its
+ * contents from the swap disk. */
 static bool anon_swap_in(struct page *page, void *kva)
 {
     struct anon_page *anon_page = &page->anon;
+    struct zswap_entry *e;
+    size_t slot;
+
+    lock_acquire(&swap_lock);
+    e = anon_page->zswap;
+    if (e != NULL)
+    {
+        zswap_remove(e);
+        zswap_hit_cnt++;
+        lock_release(&swap_lock);
+
+        lz_decompress(e->data, e->size, kva);
+        free(e);
+        return true;
+    }
+    slot = anon_page->swap_slot;
+    if (slot != BITMAP_ERROR)
+        swap_read_cnt++;
+    lock_release(&swap_lock);
+
+    if (slot == BITMAP_ERROR)
+        return false;
+
+    for (size_t i = 0; i < SECTORS_PER_SLOT; i++)
+        disk_read(swap_disk, slot * SECTORS_PER_SLOT + i, kva + i * DISK_SECTOR_SIZE);
+
+    lock_acquire(&swap_lock);
+    bitmap_reset(swap_table, slot);
+    lock_release(&swap_lock);
+    anon_page->swap_slot = BITMAP_ERROR;
+    return true;
 }
 
-/* Swap out the page by writing contents to the swap disk. */
+/* Swap out the page by compressing it into the pool, or by writing its
+ * contents to the swap disk if it does not compress well. */
 static bool anon_swap_out(struct page *page)
 {
     struct anon_page *anon_page = &page->anon;
+    void *kva = page->frame->kva;
+    struct zswap_entry *e = NULL;
+    size_t size;
+    bool success = true;
+
+    lock_acquire(&swap_lock);
+    size = lz_compress(kva, zswap_buf, ZSWAP_MAX_SIZE);
+    if (size != 0)
+        e = malloc(sizeof *e + size);
+    if (e != NULL)
+    {
+        e->page = page;
+        e->size = size;
+        memcpy(e->data, zswap_buf, size);
+        list_push_back(&zswap_lru, &e->elem);
+        zswap_bytes += size;
+        anon_page->zswap = e;
+        zswap_store_cnt++;
+        zswap_shrink();
+    } else
+    {
+        anon_page->swap_slot = swap_write(kva);
+        success = anon_page->swap_slot != BITMAP_ERROR;
+    }
+    lock_release(&swap_lock);
+    return success;
 }
 
 /* Destroy the anonymous page. PAGE will be freed by the caller. */
 static void anon_destroy(struct page *page)
 {
     struct anon_page *anon_page = &page->anon;
+
+    vm_frame_free(page);
+    lock_acquire(&swap_lock);
+    if (anon_page->zswap != NULL)
+    {
+        struct zswap_entry *e = anon_page->zswap;
+        zswap_remove(e);
+        free(e);
+    }
+    if (anon_page->swap_slot != BITMAP_ERROR)
+    {
+        bitmap_reset(swap_table, anon_page->swap_slot);
+        anon_page->swap_slot = BITMAP_ERROR;
+    }
+    lock_release(&swap_lock);
+}
+
+/* Prints swap statistics. */
+void vm_anon_print_stats(void)
+{
+    printf("Swap: %lld pages compressed, %lld read from pool, %lld written to disk, %lld read from disk\n",
+           zswap_store_cnt, zswap_hit_cnt, zswap_writeback_cnt, swap_read_cnt);
+}
+
+/* LZ codec for zswap, in the style of LZ4.  The output is a series of
+ * sequences, each a token byte, literals, and a back reference:
+ *
+ *   token: literal count in the high nibble, match length minus
+ *          LZ_MIN_MATCH in the low nibble; a nibble of 15 continues in
+ *          the bytes that follow, each adding up to 255.
+ *   literals: copied as is.
+ *   offset: 2 bytes, little-endian, distance back to the match.
+ *
+ * The last sequence has no back reference; the input ends after its
+ * literals.  Input is always one page. */
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 12
+
+/* Positions of recently seen 4-byte strings, by hash. */
+static uint16_t lz_table[1 << LZ_HASH_BITS];
+
+static uint32_t lz_read32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof v);
+    return v;
+}
+
+static size_t lz_hash(uint32_t v)
+{
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/* Appends length N in the continuation bytes after a nibble of 15.
+ * Returns the new end of output, or NULL past DST_END. */
+static uint8_t *lz_put_length(uint8_t *op, const uint8_t *dst_end, size_t n)
+{
+    for (; n >= 255; n -= 255)
+    {
+        if (op >= dst_end)
+            return NULL;
+        *op++ = 255;
+    }
+    if (op >= dst_end)
+        return NULL;
+    *op++ = n;
+    return op;
+}
+
+/* Writes one sequence of the LIT_CNT literals at LIT and, if MATCH_LEN
+ * is nonzero, a back reference OFFSET bytes back.  Returns the new end
+ * of output, or NULL past DST_END. */
+static uint8_t *lz_put_sequence(uint8_t *op, const uint8_t *dst_end, const uint8_t *lit, size_t lit_cnt,
+                                size_t offset, size_t match_len)
+{
+    size_t ml = match_len != 0 ? match_len - LZ_MIN_MATCH : 0;
+    uint8_t *token = op++;
+
+    if (token >= dst_end)
+        return NULL;
+    *token = (lit_cnt < 15 ? lit_cnt : 15) << 4 | (ml < 15 ? ml : 15);
+    if (lit_cnt >= 15 && (op = lz_put_length(op, dst_end, lit_cnt - 15)) == NULL)
+        return NULL;
+    if (op + lit_cnt > dst_end)
+        return NULL;
+    memcpy(op, lit, lit_cnt);
+    op += lit_cnt;
+    if (match_len == 0)
+        return op;
+    if (op + 2 > dst_end)
+        return NULL;
+    *op++ = offset & 0xff;
+    *op++ = offset >> 8;
+    if (ml >= 15)
+        op = lz_put_length(op, dst_end, ml - 15);
+    return op;
+}
+
+/* Compresses the page at SRC into at most DST_MAX bytes at DST.
+ * Returns the compressed size, or 0 if it does not fit. */
+static size_t lz_compress(const uint8_t *src, uint8_t *dst, size_t dst_max)
+{
+    const uint8_t *ip = src, *anchor = src;
+    const uint8_t *end = src + PGSIZE;
+    const uint8_t *match_limit = end - LZ_MIN_MATCH;
+    const uint8_t *dst_end = dst + dst_max;
+    uint8_t *op = dst;
+
+    memset(lz_table, 0, sizeof lz_table);
+    ip++;
+    while (ip <= match_limit)
+    {
+        uint32_t v = lz_read32(ip);
+        size_t h = lz_hash(v);
+        const uint8_t *ref = src + lz_table[h];
+        size_t len;
+
+        lz_table[h] = ip - src;
+        if (ref >= ip || lz_read32(ref) != v)
+        {
+            ip++;
+            continue;
+        }
+
+        len = LZ_MIN_MATCH;
+        while (ip + len < end && ref[len] == ip[len])
+            len++;
+        op = lz_put_sequence(op, dst_end, anchor, ip - anchor, ip - ref, len);
+        if (op == NULL)
+            return 0;
+        ip += len;
+        anchor = ip;
+    }
+    op = lz_put_sequence(op, dst_end, anchor, end - anchor, 0, 0);
+    return op != NULL ? (size_t)(op - dst) : 0;
+}
+
+/* Reads a length that continues past a nibble of 15. */
+static size_t lz_get_length(const uint8_t **ip)
+{
+    size_t n = 0;
+    uint8_t b;
+
+    do
+        n += b = *(*ip)++;
+    while (b == 255);
+    return n;
+}
+
+/* Decompresses SRC_SIZE bytes at SRC, produced by lz_compress(), into
+ * the page at DST. */
+static void lz_decompress(const uint8_t *src, size_t src_size, uint8_t *dst)
+{
+    const uint8_t *ip = src;
+    const uint8_t *end = src + src_size;
+    uint8_t *op = dst;
+
+    while (ip < end)
+    {
+        uint8_t token = *ip++;
+        size_t lit_cnt = token >> 4;
+        size_t match_len = token & 15;
+        const uint8_t *ref;
+
+        if (lit_cnt == 15)
+            lit_cnt += lz_get_length(&ip);
+        memcpy(op, ip, lit_cnt);
+        op += lit_cnt;
+        ip += lit_cnt;
+        if (ip >= end)
+            break;
+
+        ref = op - (ip[0] | ip[1] << 8);
+        ip += 2;
+        if (match_len == 15)
+            match_len += lz_get_length(&ip);
+        match_len += LZ_MIN_MATCH;
+
+        /* The match may overlap the bytes it produces. */
+        while (match_len-- > 0)
+            *op++ = *ref++;
+    }
+    ASSERT(op == dst + PGSIZE);
 }
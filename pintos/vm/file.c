@@ -1,6 +1,13 @@
 /* file.c: Implementation of memory backed file object (mmaped object). */
 
+#include <round.h>
+#include <string.h>
+#include <mman.h>
 #include "vm/vm.h"
+#include "filesys/filesys.h"
+#include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/vaddr.h"
 
 static bool file_backed_swap_in(struct page *page, void *kva);
 static bool file_backed_swap_out(struct page *page);
@@ -20,38 +27,213 @@ void vm_file_init(void)
 }
 
 /* Initialize the file backed page */
-bool file_backed_initializer(struct page *page, enum vm_type type, void *kva)
+bool file_backed_initializer(struct page *page, enum vm_type type UNUSED, void *kva UNUSED)
 {
+    /* Take the AUX before the union is overwritten. */
+    struct file_page *aux = page->uninit.aux;
+
     /* Set up the handler */
     page->operations = &file_ops;
 
     struct file_page *file_page = &page->file;
+    *file_page = *aux;
+    free(aux);
+    return file_backed_swap_in(page, kva);
 }
 
 /* Swap in the page by read contents from the file. */
 static bool file_backed_swap_in(struct page *page, void *kva)
 {
-    struct file_page *file_page UNUSED = &page->file;
+    struct file_page *file_page = &page->file;
+    off_t bytes_read;
+
+    lock_acquire(&filesys_lock);
+    bytes_read = file_read_at(file_page->file, kva, file_page->read_bytes, file_page->ofs);
+    lock_release(&filesys_lock);
+    if (bytes_read != (off_t)file_page->read_bytes)
+        return false;
+    memset(kva + file_page->read_bytes, 0, PGSIZE - file_page->read_bytes);
+    return true;
+}
+
+/* Writes resident PAGE back to its file if user code has modified it.
+ * The dirty bit is cleared first, so that a store that races with the
+ * write marks the page dirty again.  Returns true if PAGE was written. */
+bool file_backed_writeback(struct page *page)
+{
+    struct file_page *file_page = &page->file;
+    uint64_t *pml4 = page->owner->pml4;
+
+    if (pml4 == NULL || !pml4_is_dirty(pml4, page->va))
+        return false;
+    pml4_set_dirty(pml4, page->va, false);
+    lock_acquire(&filesys_lock);
+    file_write_at(file_page->file, page->frame->kva, file_page->read_bytes, file_page->ofs);
+    lock_release(&filesys_lock);
+    return true;
 }
 
 /* Swap out the page by writeback contents to the file. */
 static bool file_backed_swap_out(struct page *page)
 {
-    struct file_page *file_page UNUSED = &page->file;
+    file_backed_writeback(page);
+    return true;
 }
 
-/* Destory the file backed page. PAGE will be freed by the caller. */
+/* Destory the file backed page. PAGE will be freed by the caller.
+ * Only pages that vm_writebackd has not cleaned yet cost a write here;
+ * one it is writing right now is waited for by vm_frame_pin(). */
 static void file_backed_destroy(struct page *page)
 {
-    struct file_page *file_page UNUSED = &page->file;
+    struct file_page *file_page = &page->file;
+
+    if (vm_frame_pin(page))
+    {
+        file_backed_writeback(page);
+        vm_frame_free(page);
+    }
+    lock_acquire(&filesys_lock);
+    file_close(file_page->file);
+    lock_release(&filesys_lock);
+}
+
+/* Returns the start of the mmap() region that file-backed PAGE belongs
+ * to, or NULL if PAGE is not mapped by mmap(). */
+void *file_page_mapping(struct page *page)
+{
+    if (VM_TYPE(page->operations->type) == VM_UNINIT)
+    {
+        struct file_page *aux = page->uninit.aux;
+        return aux != NULL ? aux->map_addr : NULL;
+    }
+    return page->file.map_addr;
+}
+
+/* Returns a malloc()'d copy of FILE_PAGE with a file handle of its own,
+ * or NULL if memory runs out. */
+struct file_page *file_page_duplicate(const struct file_page *file_page)
+{
+    struct file_page *copy = malloc(sizeof *copy);
+
+    if (copy == NULL)
+        return NULL;
+    *copy = *file_page;
+    lock_acquire(&filesys_lock);
+    copy->file = file_reopen(file_page->file);
+    lock_release(&filesys_lock);
+    if (copy->file == NULL)
+    {
+        free(copy);
+        return NULL;
+    }
+    return copy;
+}
+
+/* Closes and frees FILE_PAGE, as allocated for a page's AUX.
+ * Does nothing if FILE_PAGE is null. */
+void file_page_free(struct file_page *file_page)
+{
+    if (file_page != NULL)
+    {
+        lock_acquire(&filesys_lock);
+        file_close(file_page->file);
+        lock_release(&filesys_lock);
+        free(file_page);
+    }
+}
+
+/* Removes the pages of the mmap() region at ADDR from SPT, writing back
+ * the dirty ones. */
+static void unmap_region(struct supplemental_page_table *spt, void *addr)
+{
+    struct tlb_gather tlb;
+    struct page *page;
+
+    tlb_gather_begin(&tlb, thread_current()->pml4);
+    for (void *va = addr; (page = spt_find_page(spt, va)) != NULL; va += PGSIZE)
+    {
+        if (page_get_type(page) != VM_FILE || file_page_mapping(page) != addr)
+            break;
+        spt_remove_page(spt, page);
+    }
+    tlb_gather_finish(&tlb);
 }
 
 /* Do the mmap */
 void *do_mmap(void *addr, size_t length, int writable, struct file *file, off_t offset)
 {
+    struct supplemental_page_table *spt = &thread_current()->spt;
+    bool populate = (writable & MAP_POPULATE) != 0;
+    size_t page_cnt;
+    off_t file_len;
+    void *va;
+
+    writable &= ~MAP_POPULATE;
+    if (addr == NULL || pg_ofs(addr) != 0 || offset < 0 || offset % PGSIZE != 0 || length == 0)
+        return NULL;
+    page_cnt = DIV_ROUND_UP(length, PGSIZE);
+    if ((uint64_t)addr + page_cnt * PGSIZE < (uint64_t)addr || !is_user_vaddr(addr + page_cnt * PGSIZE - 1))
+        return NULL;
+    lock_acquire(&filesys_lock);
+    file_len = file_length(file);
+    lock_release(&filesys_lock);
+    if (file_len <= 0)
+        return NULL;
+
+    lock_acquire(&spt->lock);
+    for (va = addr; va < addr + page_cnt * PGSIZE; va += PGSIZE)
+        if (spt_find_page(spt, va) != NULL)
+            goto fail;
+
+    for (va = addr; va < addr + page_cnt * PGSIZE; va += PGSIZE)
+    {
+        off_t ofs = offset + (va - addr);
+        struct file_page *aux = malloc(sizeof *aux);
+
+        if (aux == NULL)
+            goto undo;
+        lock_acquire(&filesys_lock);
+        aux->file = file_reopen(file);
+        lock_release(&filesys_lock);
+        if (aux->file == NULL)
+        {
+            free(aux);
+            goto undo;
+        }
+        aux->ofs = ofs;
+        aux->read_bytes = ofs < file_len ? (file_len - ofs < PGSIZE ? file_len - ofs : PGSIZE) : 0;
+        aux->map_addr = addr;
+        if (!vm_alloc_page_with_initializer(VM_FILE, va, writable, NULL, aux))
+        {
+            file_page_free(aux);
+            goto undo;
+        }
+    }
+
+    /* MAP_POPULATE: fault the whole mapping in now, in file order, so
+     * the reads go to the disk back to back instead of one per fault
+     * later.  Best effort; whatever does not fit is loaded lazily. */
+    if (populate)
+        for (va = addr; va < addr + page_cnt * PGSIZE; va += PGSIZE)
+            if (!vm_claim_page(va))
+                break;
+
+    lock_release(&spt->lock);
+    return addr;
+
+undo:
+    unmap_region(spt, addr);
+fail:
+    lock_release(&spt->lock);
+    return NULL;
 }
 
 /* Do the munmap */
 void do_munmap(void *addr)
 {
+    struct supplemental_page_table *spt = &thread_current()->spt;
+
+    lock_acquire(&spt->lock);
+    unmap_region(spt, addr);
+    lock_release(&spt->lock);
 }
@@ -48,7 +48,6 @@ static bool uninit_initialize(struct page *page, void *kva)
     vm_initializer *init = uninit->init;
     void *aux = uninit->aux;
 
-    /* TODO: You may need to fix this function. */
     return uninit->page_initializer(page, uninit->type, kva) && (init ? init(page, aux) : true);
 }
 
@@ -58,7 +57,11 @@ static bool uninit_initialize(struct page *page, void *kva)
  * PAGE will be freed by the caller. */
 static void uninit_destroy(struct page *page)
 {
-    struct uninit_page *uninit UNUSED = &page->uninit;
-    /* TODO: Fill this function.
-     * TODO: If you don't have anything to do, just return. */
+    struct uninit_page *uninit = &page->uninit;
+
+    /* An untouched page may still be mapped to the zero frame. */
+    vm_frame_free(page);
+
+    /* A lazily loaded page's AUX, if any, is a struct file_page. */
+    file_page_free(uninit->aux);
 }
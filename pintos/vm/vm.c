@@ -1,9 +1,129 @@
 /* vm.c: Generic interface for virtual memory objects. */
 
+#include <bitmap.h>
+#include <memstat.h>
+#include <mman.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/file.h"
+#include "filesys/filesys.h"
+#include "filesys/inode.h"
 #include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/vaddr.h"
 #include "vm/vm.h"
 #include "vm/inspect.h"
 
+/* Pages read ahead of a fault on a file-backed page, by madvise() hint. */
+#define READAHEAD_NORMAL 2
+#define READAHEAD_SEQUENTIAL 16
+
+/* A MADV_SEQUENTIAL reader drops the clean page this far behind it. */
+#define DROP_BEHIND READAHEAD_SEQUENTIAL
+
+/* The user stack may grow to this size. */
+#define STACK_MAX (1 << 20)
+
+/* A fault this many bytes below the user rsp still counts as stack
+ * access, for instructions that push before moving rsp. */
+#define STACK_SLACK 32
+
+/* Stack faults this many ticks apart are a burst: each grows the stack
+ * by twice as many pages as the last, up to STACK_GROW_MAX. */
+#define STACK_GROW_BURST (TIMER_FREQ / 10)
+#define STACK_GROW_MAX 16
+
+/* Timer ticks between two passes of vm_writebackd. */
+#define WRITEBACK_INTERVAL TIMER_FREQ
+
+/* Timer ticks between two batches of vm_ksmd. */
+#define KSM_INTERVAL (TIMER_FREQ / 10)
+
+/* Frame table: every frame that currently backs a user page. */
+static struct list frame_table;
+static struct lock frame_lock;
+static struct list_elem *clock_hand; /* Next frame the clock looks at. */
+static struct condition writeback_done; /* Signaled when a write-back ends. */
+
+/* Working-set estimation and resident-set limits.  Each process counts
+ * its resident pages, and the pages that the clock finds accessed in a
+ * sweep of the frame table; the count from the last complete sweep is
+ * its working set.  All of it is protected by FRAME_LOCK. */
+static unsigned clock_sweeps;   /* Times the clock went around. */
+static size_t rss_over_cnt;     /* Processes over their soft RSS limit. */
+
+/* -rss: Default soft RSS limit of a process in pages, or 0 for none. */
+size_t rss_soft_limit;
+
+/* A page of zeros, mapped read-only in place of every anonymous page
+ * that has been read but never written. */
+static void *zero_kva;
+
+/* Pending MADV_WILLNEED requests, serviced by vm_prefetchd. */
+struct prefetch_req {
+    struct list_elem elem;
+    struct thread *owner; /* Process to prefetch for. */
+    void *start, *end;    /* Page range, END exclusive. */
+};
+
+static struct list prefetch_queue;
+static struct lock prefetch_lock;
+static struct condition prefetch_ready; /* Signaled when a request is queued. */
+static struct condition prefetch_idle;  /* Signaled when a request is done. */
+static struct thread *prefetch_owner;   /* Owner of the request in service. */
+
+static void vm_prefetchd(void *aux);
+static void vm_writebackd(void *aux);
+
+/* Shared frames.
+ *
+ * A shared frame is mapped read-only into every page that uses it.  It
+ * is not in the frame table, so it is never evicted, and it is freed
+ * along with the last page that uses it.  There are two kinds.
+ *
+ * Text frames hold a page of an executable and are kept in TEXT_TABLE
+ * by inode, offset and length, so that every process running the
+ * program maps the same frames.  Two segments may start and end in the
+ * same page of the file, which is why the length is part of the key.
+ * A page of a writable segment maps its text frame read-only as well,
+ * and text_unshare() gives it a private copy on its first write.
+ *
+ * Merged frames come from kernel same-page merging.  vm_ksmd scans
+ * anonymous frames a batch at a time and merges frames with equal
+ * contents into one, which is kept in KSM_TABLE by contents.  Two
+ * equal frames that are not in the table yet meet in a per-batch table
+ * of candidates; the first becomes the shared copy.  A write to a
+ * merged page faults, and vm_handle_wp() gives the page a private copy
+ * again. */
+struct shared_frame {
+    struct hash_elem elem; /* Element in TEXT_TABLE, KSM_TABLE or a batch's candidates. */
+    void *kva;             /* The contents, read-only once shared. */
+    int sharers;           /* Pages mapping KVA; 0 for a candidate. */
+    struct inode *inode;   /* Text frame's executable, or NULL for a merged frame. */
+    off_t ofs;             /* Text frame's offset in INODE. */
+    uint32_t read_bytes;   /* Text frame's bytes from INODE; the rest are zero. */
+    uint64_t checksum;     /* Merged frame's hash_bytes() of the contents. */
+    struct frame *frame;   /* Merge candidate's private frame. */
+};
+
+/* -ksm: Frames vm_ksmd scans per batch, or 0 to not run it. */
+size_t ksm_pages_to_scan;
+
+static struct lock shared_lock; /* Protects both tables and sharer counts. */
+static struct hash text_table;
+static struct hash ksm_table;
+static struct list_elem *ksm_cursor;  /* Next frame vm_ksmd looks at. */
+static long long ksm_merge_cnt;       /* Pages merged into a shared frame. */
+static long long ksm_unmerge_cnt;     /* Pages given a private copy back. */
+static long long text_unshare_cnt;    /* Text pages given a private copy. */
+
+static void vm_ksmd(void *aux);
+static uint64_t text_frame_hash(const struct hash_elem *e, void *aux);
+static bool text_frame_less(const struct hash_elem *a, const struct hash_elem *b, void *aux);
+static uint64_t ksm_frame_hash(const struct hash_elem *e, void *aux);
+static bool ksm_frame_less(const struct hash_elem *a, const struct hash_elem *b, void *aux);
+
 /* Initializes the virtual memory subsystem by invoking each subsystem's
  * intialize codes. */
 void vm_init(void)
@@ -15,7 +135,24 @@ void vm_init(void)
 #endif
     register_inspect_intr();
     /* DO NOT MODIFY UPPER LINES. */
-    /* TODO: Your code goes here. */
+    list_init(&frame_table);
+    lock_init(&frame_lock);
+    clock_hand = NULL;
+    cond_init(&writeback_done);
+    zero_kva = palloc_get_page(PAL_ASSERT | PAL_ZERO);
+
+    list_init(&prefetch_queue);
+    lock_init(&prefetch_lock);
+    cond_init(&prefetch_ready);
+    cond_init(&prefetch_idle);
+    thread_create("vm_prefetchd", PRI_DEFAULT, vm_prefetchd, NULL);
+    thread_create("vm_writebackd", PRI_DEFAULT, vm_writebackd, NULL);
+
+    hash_init(&text_table, text_frame_hash, text_frame_less, NULL);
+    hash_init(&ksm_table, ksm_frame_hash, ksm_frame_less, NULL);
+    lock_init(&shared_lock);
+    if (ksm_pages_to_scan > 0)
+        thread_create("vm_ksmd", PRI_MIN, vm_ksmd, NULL);
 }
 
 /* Get the type of the page. This function is useful if you want to know the
@@ -36,6 +173,8 @@ enum vm_type page_get_type(struct page *page)
 /* Helpers */
 static struct frame *vm_get_victim(void);
 static bool vm_do_claim_page(struct page *page);
+static bool vm_claim_frame(struct page *page, bool may_evict);
+static bool vm_claim_huge(struct supplemental_page_table *spt, struct page *page);
 static struct frame *vm_evict_frame(void);
 
 /* Create the pending page object with initializer. If you want to create a
@@ -51,93 +190,709 @@ bool vm_alloc_page_with_initializer(enum vm_type type, void *upage, bool writabl
     /* Check wheter the upage is already occupied or not. */
     if (spt_find_page(spt, upage) == NULL)
     {
-        /* TODO: Create the page, fetch the initialier according to the VM type,
-         * TODO: and then create "uninit" page struct by calling uninit_new. You
-         * TODO: should modify the field after calling the uninit_new. */
+        bool (*initializer)(struct page *, enum vm_type, void *);
+        struct page *page;
+
+        switch (VM_TYPE(type))
+        {
+            case VM_ANON:
+                initializer = anon_initializer;
+                break;
+            case VM_FILE:
+                initializer = file_backed_initializer;
+                break;
+            default:
+                goto err;
+        }
+
+        page = malloc(sizeof *page);
+        if (page == NULL)
+            goto err;
 
-        /* TODO: Insert the page into the spt. */
+        uninit_new(page, upage, init, type, aux, initializer);
+        page->owner = thread_current();
+        page->writable = writable;
+        page->advice = MADV_NORMAL;
+
+        if (!spt_insert_page(spt, page))
+        {
+            free(page);
+            goto err;
+        }
+        return true;
     }
 err:
     return false;
 }
 
 /* Find VA from spt and return page. On error, return NULL. */
-struct page *spt_find_page(struct supplemental_page_table *spt UNUSED, void *va UNUSED)
+struct page *spt_find_page(struct supplemental_page_table *spt, void *va)
 {
-    struct page *page = NULL;
-    /* TODO: Fill this function. */
+    struct page key;
+    struct hash_elem *e;
 
-    return page;
+    key.va = pg_round_down(va);
+    e = hash_find(&spt->pages, &key.spt_elem);
+    return e != NULL ? hash_entry(e, struct page, spt_elem) : NULL;
 }
 
 /* Insert PAGE into spt with validation. */
-bool spt_insert_page(struct supplemental_page_table *spt UNUSED, struct page *page UNUSED)
+bool spt_insert_page(struct supplemental_page_table *spt, struct page *page)
 {
-    int succ = false;
-    /* TODO: Fill this function. */
-
-    return succ;
+    return hash_insert(&spt->pages, &page->spt_elem) == NULL;
 }
 
 void spt_remove_page(struct supplemental_page_table *spt, struct page *page)
 {
+    hash_delete(&spt->pages, &page->spt_elem);
     vm_dealloc_page(page);
-    return true;
+}
+
+/* Removes FRAME from the frame table.  Caller holds FRAME_LOCK. */
+static void frame_table_remove(struct frame *frame)
+{
+    if (clock_hand == &frame->elem)
+        clock_hand = list_next(clock_hand);
+    if (ksm_cursor == &frame->elem)
+        ksm_cursor = list_next(ksm_cursor);
+    list_remove(&frame->elem);
+}
+
+/* Returns true if SPT's process has more pages resident than its soft
+ * RSS limit allows. */
+static bool spt_over_limit(struct supplemental_page_table *spt)
+{
+    return spt->rss_limit != 0 && spt->rss > spt->rss_limit;
+}
+
+/* Starts a new working-set sample for SPT if the clock has gone around
+ * since its last one.  Caller holds FRAME_LOCK. */
+static void wss_roll(struct supplemental_page_table *spt)
+{
+    if (spt->wss_sweep != clock_sweeps)
+    {
+        spt->wss = spt->wss_sweep + 1 == clock_sweeps ? spt->wss_sample : 0;
+        spt->wss_sample = 0;
+        spt->wss_sweep = clock_sweeps;
+    }
+}
+
+/* Adds DELTA to the resident pages of SPT's process, or changes its
+ * soft limit to LIMIT, keeping RSS_OVER_CNT up to date.  Caller holds
+ * FRAME_LOCK. */
+static void rss_update(struct supplemental_page_table *spt, int delta, size_t limit)
+{
+    bool was_over = spt_over_limit(spt);
+
+    spt->rss += delta;
+    spt->rss_limit = limit;
+    rss_over_cnt += spt_over_limit(spt) - was_over;
+}
+
+/* Counts PAGE as resident.  Caller holds FRAME_LOCK. */
+static void rss_add(struct page *page)
+{
+    struct supplemental_page_table *spt = &page->owner->spt;
+    rss_update(spt, 1, spt->rss_limit);
+}
+
+/* Counts PAGE as no longer resident.  Caller holds FRAME_LOCK. */
+static void rss_sub(struct page *page)
+{
+    struct supplemental_page_table *spt = &page->owner->spt;
+    rss_update(spt, -1, spt->rss_limit);
+}
+
+/* Runs the second-chance clock for up to SWEEPS sweeps of the frame
+ * table and returns the frame it picks, or NULL.  Looks only at pages
+ * of processes over their RSS limit if OVER_ONLY.  The accessed bits
+ * it clears double as working-set samples.  The last sweep also takes
+ * dirty file pages, which the others pass over because vm_writebackd
+ * will clean them soon. */
+static struct frame *clock_scan(size_t sweeps, bool over_only)
+{
+    struct frame *victim = NULL;
+    size_t frame_cnt = list_size(&frame_table);
+    size_t budget = sweeps * frame_cnt;
+
+    while (victim == NULL && budget-- > 0)
+    {
+        if (clock_hand == NULL || clock_hand == list_end(&frame_table))
+        {
+            clock_hand = list_begin(&frame_table);
+            clock_sweeps++;
+        }
+
+        struct frame *frame = list_entry(clock_hand, struct frame, elem);
+        clock_hand = list_next(clock_hand);
+
+        if (frame->pinned)
+            continue;
+
+        struct page *page = frame->page;
+        struct supplemental_page_table *spt = &page->owner->spt;
+        uint64_t *pml4 = page->owner->pml4;
+        if (over_only && !spt_over_limit(spt))
+            continue;
+        if (pml4_is_accessed(pml4, page->va))
+        {
+            pml4_set_accessed(pml4, page->va, false);
+            wss_roll(spt);
+            spt->wss_sample++;
+        } else if (budget < frame_cnt || VM_TYPE(page->operations->type) != VM_FILE ||
+                   !pml4_is_dirty(pml4, page->va))
+            victim = frame;
+    }
+
+    return victim;
 }
 
 /* Get the struct frame, that will be evicted. */
 static struct frame *vm_get_victim(void)
 {
     struct frame *victim = NULL;
-    /* TODO: The policy for eviction is up to you. */
 
+    ASSERT(lock_held_by_current_thread(&frame_lock));
+
+    /* Processes over their soft RSS limit give up their own pages
+     * first.  Otherwise, three sweeps find a victim unless every frame
+     * is pinned. */
+    if (rss_over_cnt > 0)
+        victim = clock_scan(2, true);
+    if (victim == NULL)
+        victim = clock_scan(3, false);
     return victim;
 }
 
 /* Evict one page and return the corresponding frame.
- * Return NULL on error.*/
+ * Return NULL on error.  Caller holds FRAME_LOCK, which is released
+ * while the page is written out. */
 static struct frame *vm_evict_frame(void)
 {
-    struct frame *victim UNUSED = vm_get_victim();
-    /* TODO: swap out the victim and return the evicted frame. */
+    struct frame *victim;
+    struct page *page;
+    bool swapped;
+
+    ASSERT(lock_held_by_current_thread(&frame_lock));
+
+    victim = vm_get_victim();
+    if (victim == NULL)
+        return NULL;
 
-    return NULL;
+    /* Take the victim out of the table and unmap it, so the owner
+     * faults (and waits for the write-back) instead of writing to a
+     * page that is on its way out.  The write itself runs without
+     * FRAME_LOCK, so that other faults need not wait for the disk. */
+    page = victim->page;
+    victim->pinned = true;
+    victim->writeback = true;
+    frame_table_remove(victim);
+    pml4_clear_page(page->owner->pml4, page->va);
+    lock_release(&frame_lock);
+
+    swapped = swap_out(page);
+
+    lock_acquire(&frame_lock);
+    victim->writeback = false;
+    cond_broadcast(&writeback_done, &frame_lock);
+    if (!swapped)
+    {
+        pml4_set_page(page->owner->pml4, page->va, victim->kva, page->writable);
+        victim->pinned = false;
+        list_push_back(&frame_table, &victim->elem);
+        return NULL;
+    }
+
+    rss_sub(page);
+    page->frame = NULL;
+    victim->page = NULL;
+    return victim;
 }
 
 /* palloc() and get frame. If there is no available page, evict the page
  * and return it. This always return valid address. That is, if the user pool
  * memory is full, this function evicts the frame to get the available memory
- * space.*/
-static struct frame *vm_get_frame(void)
+ * space.
+ * The frame comes back pinned; the caller unpins it once it is mapped.
+ * Returns NULL if MAY_EVICT is false and no frame is free, or if every
+ * frame in use is pinned. */
+static struct frame *vm_get_frame(bool may_evict)
 {
     struct frame *frame = NULL;
-    /* TODO: Fill this function. */
+    void *kva = palloc_get_page(PAL_USER);
 
-    ASSERT(frame != NULL);
-    ASSERT(frame->page == NULL);
+    if (kva != NULL)
+    {
+        frame = malloc(sizeof *frame);
+        if (frame == NULL)
+        {
+            palloc_free_page(kva);
+            return NULL;
+        }
+        frame->kva = kva;
+        frame->page = NULL;
+        frame->pinned = true;
+        frame->writeback = false;
+
+        lock_acquire(&frame_lock);
+        list_push_back(&frame_table, &frame->elem);
+        lock_release(&frame_lock);
+    } else if (may_evict)
+    {
+        lock_acquire(&frame_lock);
+        frame = vm_evict_frame();
+        lock_release(&frame_lock);
+    }
+
+    ASSERT(frame == NULL || frame->page == NULL);
     return frame;
 }
 
-/* Growing the stack. */
-static void vm_stack_growth(void *addr UNUSED)
+/* Drops PAGE's reference to its shared frame, freeing the frame
+ * along with the last reference. */
+static void shared_put(struct page *page)
+{
+    struct shared_frame *sf = page->shared;
+    bool last;
+
+    page->shared = NULL;
+    lock_acquire(&shared_lock);
+    last = --sf->sharers == 0;
+    if (last)
+        hash_delete(sf->inode != NULL ? &text_table : &ksm_table, &sf->elem);
+    lock_release(&shared_lock);
+
+    if (last)
+    {
+        inode_close(sf->inode);
+        palloc_free_page(sf->kva);
+        free(sf);
+    }
+}
+
+/* Waits until PAGE's frame, if any, is not being written back.
+ * Caller holds FRAME_LOCK. */
+static void frame_wait_writeback(struct page *page)
+{
+    while (page->frame != NULL && page->frame->writeback)
+        cond_wait(&writeback_done, &frame_lock);
+}
+
+/* Pins PAGE's frame so that it cannot be evicted.  Returns false, doing
+ * nothing, if PAGE is not resident. */
+bool vm_frame_pin(struct page *page)
+{
+    bool resident;
+
+    lock_acquire(&frame_lock);
+    frame_wait_writeback(page);
+    resident = page->frame != NULL;
+    if (resident)
+        page->frame->pinned = true;
+    lock_release(&frame_lock);
+    return resident;
+}
+
+/* Unpins PAGE's frame, making it an eviction candidate again. */
+void vm_frame_unpin(struct page *page)
+{
+    lock_acquire(&frame_lock);
+    if (page->frame != NULL)
+        page->frame->pinned = false;
+    lock_release(&frame_lock);
+}
+
+/* Unmaps PAGE and returns its frame, if any, to the user pool.
+ * Waits for an eviction or write-back of PAGE that is in flight to
+ * finish first. */
+void vm_frame_free(struct page *page)
 {
+    struct frame *frame;
+
+    /* vm_ksmd merges pages under FRAME_LOCK, so check for a shared
+     * frame only once it is held. */
+    lock_acquire(&frame_lock);
+    if (page->zero_mapped || page->shared != NULL)
+    {
+        if (page->owner->pml4 != NULL)
+            pml4_clear_page(page->owner->pml4, page->va);
+        page->zero_mapped = false;
+        if (page->shared != NULL)
+            shared_put(page);
+    }
+
+    frame_wait_writeback(page);
+    frame = page->frame;
+    if (frame != NULL)
+    {
+        if (page->owner->pml4 != NULL)
+            pml4_clear_page(page->owner->pml4, page->va);
+        frame_table_remove(frame);
+        palloc_free_page(frame->kva);
+        free(frame);
+        rss_sub(page);
+        page->frame = NULL;
+    }
+    lock_release(&frame_lock);
+}
+
+/* Returns true if a fault at ADDR looks like the user stack, whose
+ * pointer is RSP, running into the unmapped space below it. */
+static bool is_stack_fault(void *addr, uintptr_t rsp)
+{
+    uintptr_t va = (uintptr_t)addr;
+    return va < USER_STACK && va >= USER_STACK - STACK_MAX && va + STACK_SLACK >= rsp;
+}
+
+/* Returns true if a fault at ADDR in the running process would grow
+ * its stack, judging by the user stack pointer at its last system
+ * call. */
+bool vm_is_stack_addr(void *addr)
+{
+    return is_stack_fault(addr, thread_current()->user_rsp);
+}
+
+/* Growing the stack.
+ * Adds lazy stack pages from the current bottom of the stack down to
+ * ADDR.  In a burst of faults, like deep recursion, it also maps a
+ * batch of pages below ADDR right away, so that the next few frames
+ * of the stack do not fault at all. */
+static void vm_stack_growth(void *addr)
+{
+    struct supplemental_page_table *spt = &thread_current()->spt;
+    uintptr_t limit = USER_STACK - STACK_MAX;
+    uintptr_t target = (uintptr_t)pg_round_down(addr);
+    uintptr_t new_bottom;
+    int64_t now = timer_ticks();
+    void *va;
+
+    if (now - spt->stack_grow_tick <= STACK_GROW_BURST)
+        spt->stack_grow_cnt = spt->stack_grow_cnt * 2 < STACK_GROW_MAX ? spt->stack_grow_cnt * 2 : STACK_GROW_MAX;
+    else
+        spt->stack_grow_cnt = 1;
+    spt->stack_grow_tick = now;
+
+    new_bottom = target - limit > (spt->stack_grow_cnt - 1) * PGSIZE ? target - (spt->stack_grow_cnt - 1) * PGSIZE
+                                                                      : limit;
+    for (va = spt->stack_bottom - PGSIZE; (uintptr_t)va >= new_bottom; va -= PGSIZE)
+    {
+        if (!vm_alloc_page(VM_ANON | VM_STACK, va, true))
+            break;
+        spt->stack_bottom = va;
+
+        /* The batch below the fault only takes free frames. */
+        if ((uintptr_t)va < target)
+            vm_claim_frame(spt_find_page(spt, va), false);
+    }
+}
+
+/* Returns true if PAGE has never been touched and would start out
+ * as all zeros: an anonymous page with no initializer, or a BSS page
+ * with nothing to read from its file. */
+static bool is_zero_fill(struct page *page)
+{
+    struct file_page *aux = page->uninit.aux;
+
+    if (VM_TYPE(page->operations->type) != VM_UNINIT || VM_TYPE(page->uninit.type) != VM_ANON)
+        return false;
+    return page->uninit.init == NULL || (aux != NULL && aux->read_bytes == 0);
+}
+
+/* Maps zero-fill PAGE read-only to the shared zero frame, which serves
+ * reads until the first write gives PAGE a frame of its own. */
+static bool vm_map_zero(struct page *page)
+{
+    if (!pml4_set_page(page->owner->pml4, page->va, zero_kva, false))
+        return false;
+    page->zero_mapped = true;
+    return true;
+}
+
+/* Gives merged PAGE a private, writable copy of its shared frame.
+ * The last sharer just takes the shared frame over. */
+static bool ksm_unmerge(struct page *page)
+{
+    struct shared_frame *ksm = page->shared;
+    struct frame *frame;
+
+    lock_acquire(&shared_lock);
+    if (ksm->sharers == 1)
+    {
+        frame = malloc(sizeof *frame);
+        if (frame == NULL)
+        {
+            lock_release(&shared_lock);
+            return false;
+        }
+        hash_delete(&ksm_table, &ksm->elem);
+        frame->kva = ksm->kva;
+        frame->pinned = true;
+        frame->writeback = false;
+        free(ksm);
+        lock_release(&shared_lock);
+
+        lock_acquire(&frame_lock);
+        list_push_back(&frame_table, &frame->elem);
+        lock_release(&frame_lock);
+    } else
+    {
+        lock_release(&shared_lock);
+        frame = vm_get_frame(true);
+        if (frame == NULL)
+            return false;
+        memcpy(frame->kva, ksm->kva, PGSIZE);
+        shared_put(page);
+    }
+
+    lock_acquire(&frame_lock);
+    frame->page = page;
+    page->frame = frame;
+    page->shared = NULL;
+    rss_add(page);
+    ksm_unmerge_cnt++;
+    lock_release(&frame_lock);
+    pml4_set_page(page->owner->pml4, page->va, frame->kva, page->writable);
+    vm_frame_unpin(page);
+    return true;
+}
+
+/* Gives PAGE, a page of a writable segment that maps a text frame, a
+ * private, writable copy of the frame.  PAGE becomes an ordinary
+ * anonymous page that never reads its file again. */
+static bool text_unshare(struct page *page)
+{
+    struct shared_frame *sf = page->shared;
+    struct frame *frame;
+
+    frame = vm_get_frame(true);
+    if (frame == NULL)
+        return false;
+
+    /* Drop the initializer, so that turning PAGE anonymous leaves the
+     * contents to us. */
+    file_page_free(page->uninit.aux);
+    page->uninit.aux = NULL;
+    page->uninit.init = NULL;
+
+    lock_acquire(&frame_lock);
+    frame->page = page;
+    page->frame = frame;
+    rss_add(page);
+    text_unshare_cnt++;
+    lock_release(&frame_lock);
+    swap_in(page, frame->kva);
+    memcpy(frame->kva, sf->kva, PGSIZE);
+    shared_put(page);
+
+    pml4_set_page(page->owner->pml4, page->va, frame->kva, page->writable);
+    vm_frame_unpin(page);
+    return true;
 }
 
 /* Handle the fault on write_protected page */
-static bool vm_handle_wp(struct page *page UNUSED)
+static bool vm_handle_wp(struct page *page)
 {
+    /* First write to a page that reads as zeros.  Claiming replaces
+     * the zero frame's mapping with a private, writable frame. */
+    if (page->zero_mapped)
+        return vm_do_claim_page(page);
+    if (page->shared != NULL)
+        return page->shared->inode != NULL ? text_unshare(page) : ksm_unmerge(page);
+    return false;
 }
 
-/* Return true on success */
-bool vm_try_handle_fault(struct intr_frame *f UNUSED, void *addr UNUSED, bool user UNUSED, bool write UNUSED,
-                         bool not_present UNUSED)
+/* Returns the start of the mmap() region PAGE belongs to, or NULL if
+ * PAGE is not part of one. */
+static void *page_mapping(struct page *page)
 {
-    struct supplemental_page_table *spt UNUSED = &thread_current()->spt;
-    struct page *page = NULL;
-    /* TODO: Validate the fault */
-    /* TODO: Your code goes here */
+    return page_get_type(page) == VM_FILE ? file_page_mapping(page) : NULL;
+}
 
-    return vm_do_claim_page(page);
+/* Drops PAGE from memory if it is a clean, resident, file-backed page,
+ * since it can be read back from its file at no cost.  Returns true if
+ * PAGE was dropped.  Must run in PAGE's owner. */
+static bool vm_drop_page(struct page *page)
+{
+    if (page_mapping(page) == NULL || VM_TYPE(page->operations->type) == VM_UNINIT)
+        return false;
+    if (!vm_frame_pin(page))
+        return false;
+    if (pml4_is_dirty(page->owner->pml4, page->va))
+    {
+        vm_frame_unpin(page);
+        return false;
+    }
+    vm_frame_free(page);
+    return true;
+}
+
+/* Reads ahead the pages that follow PAGE in its file mapping, as far
+ * as PAGE's madvise() hint allows.  Read-ahead only takes frames that
+ * are free; it never evicts anybody for a guess.  A sequential reader
+ * also drops what it has left behind, before it becomes eviction
+ * pressure on everybody else. */
+static void vm_readahead(struct supplemental_page_table *spt, struct page *page)
+{
+    void *mapping = page_mapping(page);
+    size_t window;
+
+    if (mapping == NULL)
+        return;
+
+    switch (page->advice)
+    {
+        case MADV_RANDOM:
+            window = 0;
+            break;
+        case MADV_SEQUENTIAL:
+            window = READAHEAD_SEQUENTIAL;
+            break;
+        default:
+            window = READAHEAD_NORMAL;
+            break;
+    }
+
+    for (size_t i = 1; i <= window; i++)
+    {
+        struct page *next = spt_find_page(spt, page->va + i * PGSIZE);
+        if (next == NULL || page_mapping(next) != mapping)
+            break;
+        if (next->frame == NULL && !vm_claim_frame(next, false))
+            break;
+    }
+
+    if (page->advice == MADV_SEQUENTIAL && (uint64_t)page->va >= (uint64_t)mapping + DROP_BEHIND * PGSIZE)
+    {
+        struct page *behind = spt_find_page(spt, page->va - DROP_BEHIND * PGSIZE);
+        if (behind != NULL && page_mapping(behind) == mapping)
+            vm_drop_page(behind);
+    }
+}
+
+/* Returns true if PAGE is an untouched page of the executable that
+ * can be served from a text frame.  A page with nothing to read from
+ * the file is left to the zero frame. */
+static bool is_text(struct page *page)
+{
+    struct file_page *seg = page->uninit.aux;
+
+    return VM_TYPE(page->operations->type) == VM_UNINIT && (page->uninit.type & VM_TEXT) && seg != NULL &&
+           seg->read_bytes > 0;
+}
+
+/* Returns true if text PAGE's frame is already in TEXT_TABLE. */
+static bool text_cached(struct page *page)
+{
+    struct file_page *seg = page->uninit.aux;
+    struct shared_frame key;
+    bool cached;
+
+    key.inode = file_get_inode(seg->file);
+    key.ofs = seg->ofs;
+    key.read_bytes = seg->read_bytes;
+    lock_acquire(&shared_lock);
+    cached = hash_find(&text_table, &key.elem) != NULL;
+    lock_release(&shared_lock);
+    return cached;
+}
+
+/* Returns true if bringing PAGE in reads from a disk: the swap disk,
+ * or the file it is loaded from.  A fault on it is a major fault. */
+static bool page_needs_io(struct page *page)
+{
+    switch (VM_TYPE(page->operations->type))
+    {
+        case VM_UNINIT:
+            return page->uninit.init != NULL && !(is_text(page) && text_cached(page));
+        case VM_ANON:
+            return page->anon.swap_slot != BITMAP_ERROR;
+        default:
+            return true;
+    }
+}
+
+/* Fast path of the fault handler, for faults that memory alone
+ * serves: a write to a read-only shared frame, a read of a page that
+ * is all zeros, and a page whose frame is still there.  Sets *KIND and
+ * returns true if it dealt with the fault, or returns false to leave
+ * it to the slow path. */
+static inline bool vm_fault_fast(struct page *page, bool write, bool not_present, enum vm_fault *kind)
+{
+    if (write && !page->writable)
+        *kind = VM_FAULT_INVALID;
+    else if (!not_present)
+        *kind = vm_handle_wp(page) ? VM_FAULT_COW : VM_FAULT_INVALID;
+    else if (!write && is_zero_fill(page))
+        *kind = vm_map_zero(page) ? VM_FAULT_MINOR : VM_FAULT_INVALID;
+    else if (page->frame != NULL)
+        *kind = vm_claim_frame(page, true) ? VM_FAULT_MINOR : VM_FAULT_INVALID;
+    else
+        return false;
+    return true;
+}
+
+/* Slow path of the fault handler: grows the stack for a fault on no
+ * page at all, and brings a page in, possibly from disk, with
+ * read-ahead around it. */
+static enum vm_fault vm_fault_slow(struct supplemental_page_table *spt, struct page *page, void *addr, uintptr_t rsp,
+                                   bool write)
+{
+    enum vm_fault kind;
+
+    if (page == NULL)
+    {
+        if (!is_stack_fault(addr, rsp))
+            return VM_FAULT_INVALID;
+        vm_stack_growth(addr);
+        page = spt_find_page(spt, addr);
+        if (page == NULL)
+            return VM_FAULT_INVALID;
+        if (vm_fault_fast(page, write, true, &kind))
+            return kind != VM_FAULT_INVALID ? VM_FAULT_STACK : kind;
+        kind = VM_FAULT_STACK;
+    } else
+        kind = page_needs_io(page) ? VM_FAULT_MAJOR : VM_FAULT_MINOR;
+
+    if (!vm_claim_huge(spt, page) && !vm_do_claim_page(page))
+        return VM_FAULT_INVALID;
+
+    /* A write to a page of a writable segment would only fault again
+     * on its text frame. */
+    if (write && page->shared != NULL && !vm_handle_wp(page))
+        return VM_FAULT_INVALID;
+
+    /* The faulting access is about to happen; make sure a read-ahead
+     * that runs short of frames cannot pick PAGE. */
+    pml4_set_accessed(page->owner->pml4, page->va, true);
+    vm_readahead(spt, page);
+    return kind;
+}
+
+/* Handles a page fault at ADDR in the running process.  Returns what
+ * kind of fault it was, or VM_FAULT_INVALID if it was a bad access. */
+enum vm_fault vm_try_handle_fault(struct intr_frame *f, void *addr, bool user, bool write, bool not_present)
+{
+    struct thread *t = thread_current();
+    struct supplemental_page_table *spt = &t->spt;
+    struct page *page;
+    enum vm_fault kind;
+
+    /* Kernel threads have no user address space to fault in. */
+    if (t->pml4 == NULL || addr == NULL || !is_user_vaddr(addr))
+        return VM_FAULT_INVALID;
+
+    lock_acquire(&spt->lock);
+    page = spt_find_page(spt, addr);
+    if (page == NULL || !vm_fault_fast(page, write, not_present, &kind))
+        kind = vm_fault_slow(spt, page, addr, user ? f->rsp : t->user_rsp, write);
+
+    if (kind == VM_FAULT_MAJOR)
+        spt->major_faults++;
+    else if (kind != VM_FAULT_INVALID)
+        spt->minor_faults++;
+    lock_release(&spt->lock);
+
+    return kind;
 }
 
 /* Free the page.
@@ -149,10 +904,11 @@ void vm_dealloc_page(struct page *page)
 }
 
 /* Claim the page that allocate on VA. */
-bool vm_claim_page(void *va UNUSED)
+bool vm_claim_page(void *va)
 {
-    struct page *page = NULL;
-    /* TODO: Fill this function */
+    struct page *page = spt_find_page(&thread_current()->spt, va);
+    if (page == NULL)
+        return false;
 
     return vm_do_claim_page(page);
 }
@@ -160,31 +916,768 @@ bool vm_claim_page(void *va UNUSED)
 /* Claim the PAGE and set up the mmu. */
 static bool vm_do_claim_page(struct page *page)
 {
-    struct frame *frame = vm_get_frame();
+    return vm_claim_frame(page, true);
+}
+
+/* Maps text PAGE read-only to the text frame for its part of the
+ * executable, reading the frame in if no other process has it yet.
+ * Returns false, leaving PAGE to be loaded privately, if that fails. */
+static bool text_claim(struct page *page)
+{
+    struct file_page *seg = page->uninit.aux;
+    struct shared_frame key, *sf;
+    struct hash_elem *e;
+    off_t bytes_read;
+
+    key.inode = file_get_inode(seg->file);
+    key.ofs = seg->ofs;
+    key.read_bytes = seg->read_bytes;
+    lock_acquire(&shared_lock);
+    e = hash_find(&text_table, &key.elem);
+    if (e != NULL)
+    {
+        sf = hash_entry(e, struct shared_frame, elem);
+        sf->sharers++;
+    }
+    lock_release(&shared_lock);
+
+    if (e == NULL)
+    {
+        sf = malloc(sizeof *sf);
+        if (sf == NULL)
+            return false;
+        sf->kva = palloc_get_page(PAL_USER);
+        if (sf->kva == NULL)
+        {
+            free(sf);
+            return false;
+        }
+        lock_acquire(&filesys_lock);
+        bytes_read = file_read_at(seg->file, sf->kva, seg->read_bytes, seg->ofs);
+        lock_release(&filesys_lock);
+        if (bytes_read != (off_t)seg->read_bytes)
+        {
+            palloc_free_page(sf->kva);
+            free(sf);
+            return false;
+        }
+        memset(sf->kva + seg->read_bytes, 0, PGSIZE - seg->read_bytes);
+        sf->sharers = 1;
+        sf->inode = inode_reopen(key.inode);
+        sf->ofs = seg->ofs;
+        sf->read_bytes = seg->read_bytes;
+        sf->checksum = 0;
+        sf->frame = NULL;
+
+        /* Another process may have read the same page meanwhile. */
+        lock_acquire(&shared_lock);
+        e = hash_insert(&text_table, &sf->elem);
+        if (e != NULL)
+            hash_entry(e, struct shared_frame, elem)->sharers++;
+        lock_release(&shared_lock);
+        if (e != NULL)
+        {
+            inode_close(sf->inode);
+            palloc_free_page(sf->kva);
+            free(sf);
+            sf = hash_entry(e, struct shared_frame, elem);
+        }
+    }
+
+    page->shared = sf;
+    if (!pml4_set_page(page->owner->pml4, page->va, sf->kva, false))
+    {
+        shared_put(page);
+        return false;
+    }
+    return true;
+}
+
+/* Brings PAGE into a frame and maps it into its owner's page table.
+ * Only evicts another page for the frame if MAY_EVICT.  PAGE may
+ * belong to a process other than the running one. */
+static bool vm_claim_frame(struct page *page, bool may_evict)
+{
+    struct frame *frame;
+
+    /* A page with a shared frame is resident in it. */
+    if (page->shared != NULL)
+        return true;
+    if (is_text(page) && text_claim(page))
+        return true;
+
+    /* PAGE still has a frame while its eviction is in flight. */
+    if (page->frame != NULL)
+    {
+        lock_acquire(&frame_lock);
+        frame_wait_writeback(page);
+        lock_release(&frame_lock);
+        if (page->frame != NULL)
+            return true;
+    }
+
+    frame = vm_get_frame(may_evict);
+    if (frame == NULL)
+        return false;
 
     /* Set links */
+    lock_acquire(&frame_lock);
     frame->page = page;
     page->frame = frame;
+    rss_add(page);
+    lock_release(&frame_lock);
+
+    /* Fill the frame before mapping it, so that the owner never sees
+     * it half loaded. */
+    if (!swap_in(page, frame->kva) || !pml4_set_page(page->owner->pml4, page->va, frame->kva, page->writable))
+    {
+        vm_frame_free(page);
+        return false;
+    }
+
+    page->zero_mapped = false;
+    vm_frame_unpin(page);
+    return true;
+}
+
+/* Returns true if PAGE is an anonymous page that has never been
+ * touched, other than a stack page. */
+static bool is_fresh_anon(struct page *page)
+{
+    return VM_TYPE(page->operations->type) == VM_UNINIT && VM_TYPE(page->uninit.type) == VM_ANON &&
+           !(page->uninit.type & (VM_STACK | VM_TEXT)) && !page->zero_mapped;
+}
+
+/* Tries to bring in the whole 2 MiB-aligned region around PAGE at once
+ * and map it with a single huge page, to spare the TLB.  Only works for
+ * a region made entirely of fresh anonymous pages with PAGE's
+ * permissions, like a large BSS, and only if the user pool has a free,
+ * aligned 2 MiB run of frames; it never evicts.  Each page still gets
+ * a frame of its own, and the huge page splits as soon as one of them
+ * is unmapped.  Returns true if PAGE is now resident. */
+static bool vm_claim_huge(struct supplemental_page_table *spt, struct page *page)
+{
+    void *base = (void *)((uint64_t)page->va & ~(HPGSIZE - 1));
+    struct list frames;
+    void *kva;
+    size_t i;
+
+    if (!is_fresh_anon(page) || !is_user_vaddr(base + HPGSIZE - 1))
+        return false;
+    for (i = 0; i < HPGCNT; i++)
+    {
+        struct page *p = spt_find_page(spt, base + i * PGSIZE);
+        if (p == NULL || !is_fresh_anon(p) || p->writable != page->writable)
+            return false;
+    }
+
+    kva = palloc_get_multiple_aligned(PAL_USER, HPGCNT, HPGCNT);
+    if (kva == NULL)
+        return false;
+
+    list_init(&frames);
+    for (i = 0; i < HPGCNT; i++)
+    {
+        struct frame *frame = malloc(sizeof *frame);
+        if (frame == NULL)
+            break;
+        list_push_back(&frames, &frame->elem);
+    }
+    if (i < HPGCNT || !pml4_set_huge_page(page->owner->pml4, base, kva, page->writable))
+    {
+        while (!list_empty(&frames))
+            free(list_entry(list_pop_front(&frames), struct frame, elem));
+        palloc_free_multiple(kva, HPGCNT);
+        return false;
+    }
+
+    /* Nothing runs in this process until the fault returns, so the
+     * frames can be filled after they are mapped.  A page that fails
+     * to fill gives its frame up, as vm_claim_frame() would. */
+    for (i = 0; i < HPGCNT; i++)
+    {
+        struct page *p = spt_find_page(spt, base + i * PGSIZE);
+        struct frame *frame = list_entry(list_pop_front(&frames), struct frame, elem);
+
+        frame->kva = kva + i * PGSIZE;
+        frame->page = p;
+        frame->pinned = true;
+        frame->writeback = false;
+
+        lock_acquire(&frame_lock);
+        p->frame = frame;
+        rss_add(p);
+        list_push_back(&frame_table, &frame->elem);
+        lock_release(&frame_lock);
+
+        if (swap_in(p, frame->kva))
+            vm_frame_unpin(p);
+        else
+            vm_frame_free(p);
+    }
+    return page->frame != NULL;
+}
+
+/* Pins the page at VA in the running process, if it is resident and
+ * ready for the access: a write needs a writable frame of its own,
+ * while a read may also be served by the zero frame or a shared
+ * frame, which never move.  Returns false if the page needs a fault
+ * first. */
+static bool user_page_pin(struct supplemental_page_table *spt, void *va, bool write)
+{
+    struct page *page;
+    bool pinned = false;
+
+    lock_acquire(&spt->lock);
+    page = spt_find_page(spt, va);
+    if (page != NULL && (!write || page->writable))
+    {
+        void *kva = pml4_get_page(page->owner->pml4, va);
+
+        if (vm_frame_pin(page))
+        {
+            /* A frame that is still being loaded is not mapped yet. */
+            pinned = kva == page->frame->kva;
+            if (!pinned)
+                vm_frame_unpin(page);
+        } else
+            pinned = kva != NULL && !write;
+    }
+    lock_release(&spt->lock);
+    return pinned;
+}
+
+/* Faults in and pins every page of the LENGTH bytes at ADDR in the
+ * running process, for a system call to read (or, if WRITE, write)
+ * them directly without faulting while it holds file system locks.
+ * Returns false, pinning nothing, if part of the range is not valid
+ * for the access.  vm_unpin_user() undoes a successful call. */
+bool vm_pin_user(void *addr, size_t length, bool write)
+{
+    struct supplemental_page_table *spt = &thread_current()->spt;
+    void *end = addr + length;
+    void *va;
+
+    if (length == 0)
+        return true;
+    if (end < addr || !is_user_vaddr(end - 1))
+        return false;
+
+    for (va = pg_round_down(addr); va < end; va += PGSIZE)
+        while (!user_page_pin(spt, va, write))
+            if (vm_try_handle_fault(NULL, va, false, write, true) == VM_FAULT_INVALID)
+            {
+                if (va > pg_round_down(addr))
+                    vm_unpin_user(addr, va - addr);
+                return false;
+            }
+    return true;
+}
+
+/* Unpins the pages of the LENGTH bytes at ADDR that vm_pin_user()
+ * pinned. */
+void vm_unpin_user(void *addr, size_t length)
+{
+    struct supplemental_page_table *spt = &thread_current()->spt;
+    void *end = addr + length;
+    void *va;
+
+    lock_acquire(&spt->lock);
+    for (va = pg_round_down(addr); va < end; va += PGSIZE)
+    {
+        struct page *page = spt_find_page(spt, va);
+        if (page != NULL)
+            vm_frame_unpin(page);
+    }
+    lock_release(&spt->lock);
+}
+
+/* Applies madvise() hint ADVICE to the LENGTH bytes at ADDR in the
+ * running process.  MADV_NORMAL, MADV_RANDOM and MADV_SEQUENTIAL stick
+ * to the pages and steer read-ahead on later faults; MADV_WILLNEED and
+ * MADV_DONTNEED act once.  Returns false if ADDR is not page-aligned or
+ * the range is not entirely mapped. */
+bool vm_madvise(void *addr, size_t length, int advice)
+{
+    struct thread *t = thread_current();
+    struct supplemental_page_table *spt = &t->spt;
+    void *end = addr + length;
+    struct tlb_gather tlb;
+    void *va;
+
+    if (pg_ofs(addr) != 0 || length == 0 || end < addr || !is_user_vaddr(end - 1))
+        return false;
+    if (advice < MADV_NORMAL || advice > MADV_DONTNEED)
+        return false;
+
+    lock_acquire(&spt->lock);
+    for (va = addr; va < end; va += PGSIZE)
+        if (spt_find_page(spt, va) == NULL)
+        {
+            lock_release(&spt->lock);
+            return false;
+        }
+
+    tlb_gather_begin(&tlb, t->pml4);
+    for (va = addr; va < end; va += PGSIZE)
+    {
+        struct page *page = spt_find_page(spt, va);
+        switch (advice)
+        {
+            case MADV_WILLNEED:
+                break;
+            case MADV_DONTNEED:
+                vm_drop_page(page);
+                break;
+            default:
+                page->advice = advice;
+                break;
+        }
+    }
+    tlb_gather_finish(&tlb);
+    lock_release(&spt->lock);
+
+    if (advice == MADV_WILLNEED)
+    {
+        struct prefetch_req *req = malloc(sizeof *req);
+        if (req != NULL)
+        {
+            req->owner = t;
+            req->start = addr;
+            req->end = pg_round_up(end);
+
+            lock_acquire(&prefetch_lock);
+            list_push_back(&prefetch_queue, &req->elem);
+            cond_signal(&prefetch_ready, &prefetch_lock);
+            lock_release(&prefetch_lock);
+        }
+    }
+    return true;
+}
+
+/* Kernel thread that services MADV_WILLNEED in the background.  Like
+ * read-ahead, it only uses frames that are free. */
+static void vm_prefetchd(void *aux UNUSED)
+{
+    for (;;)
+    {
+        struct prefetch_req *req;
+        struct supplemental_page_table *spt;
+
+        lock_acquire(&prefetch_lock);
+        while (list_empty(&prefetch_queue))
+            cond_wait(&prefetch_ready, &prefetch_lock);
+        req = list_entry(list_pop_front(&prefetch_queue), struct prefetch_req, elem);
+        prefetch_owner = req->owner;
+        lock_release(&prefetch_lock);
+
+        spt = &req->owner->spt;
+        lock_acquire(&spt->lock);
+        for (void *va = req->start; va < req->end; va += PGSIZE)
+        {
+            struct page *page = spt_find_page(spt, va);
+            if (page != NULL && page->frame == NULL && !vm_claim_frame(page, false))
+                break;
+        }
+        lock_release(&spt->lock);
+        free(req);
+
+        lock_acquire(&prefetch_lock);
+        prefetch_owner = NULL;
+        cond_broadcast(&prefetch_idle, &prefetch_lock);
+        lock_release(&prefetch_lock);
+    }
+}
+
+/* Kernel thread that writes dirty file-backed pages back in the
+ * background, so that eviction, munmap() and exit mostly find them
+ * clean and stay off the disk.  A frame being written is pinned and
+ * marked, and whoever wants to free it waits for the write. */
+static void vm_writebackd(void *aux UNUSED)
+{
+    for (;;)
+    {
+        struct list_elem *e;
 
-    /* TODO: Insert page table entry to map page's VA to frame's PA. */
+        timer_sleep(WRITEBACK_INTERVAL);
 
-    return swap_in(page, frame->kva);
+        lock_acquire(&frame_lock);
+        for (e = list_begin(&frame_table); e != list_end(&frame_table); e = list_next(e))
+        {
+            struct frame *frame = list_entry(e, struct frame, elem);
+            struct page *page = frame->page;
+
+            if (frame->pinned || VM_TYPE(page->operations->type) != VM_FILE ||
+                !pml4_is_dirty(page->owner->pml4, page->va))
+                continue;
+
+            /* The marked frame stays in the table, so E stays valid. */
+            frame->pinned = true;
+            frame->writeback = true;
+            lock_release(&frame_lock);
+
+            file_backed_writeback(page);
+
+            lock_acquire(&frame_lock);
+            frame->pinned = false;
+            frame->writeback = false;
+            cond_broadcast(&writeback_done, &frame_lock);
+        }
+        lock_release(&frame_lock);
+    }
+}
+
+/* Returns a hash value for the inode, offset and length of the text
+ * frame that E is embedded in. */
+static uint64_t text_frame_hash(const struct hash_elem *e, void *aux UNUSED)
+{
+    const struct shared_frame *sf = hash_entry(e, struct shared_frame, elem);
+    return hash_bytes(&sf->inode, sizeof sf->inode) ^ hash_int(sf->ofs) ^ hash_int(sf->read_bytes);
+}
+
+/* Orders text frames by inode, offset and length. */
+static bool text_frame_less(const struct hash_elem *a, const struct hash_elem *b, void *aux UNUSED)
+{
+    const struct shared_frame *sa = hash_entry(a, struct shared_frame, elem);
+    const struct shared_frame *sb = hash_entry(b, struct shared_frame, elem);
+
+    if (sa->inode != sb->inode)
+        return sa->inode < sb->inode;
+    if (sa->ofs != sb->ofs)
+        return sa->ofs < sb->ofs;
+    return sa->read_bytes < sb->read_bytes;
+}
+
+/* Returns a hash value for the contents of the merged frame that E is
+ * embedded in. */
+static uint64_t ksm_frame_hash(const struct hash_elem *e, void *aux UNUSED)
+{
+    return hash_entry(e, struct shared_frame, elem)->checksum;
+}
+
+/* Orders ksm_frames by contents. */
+static bool ksm_frame_less(const struct hash_elem *a, const struct hash_elem *b, void *aux UNUSED)
+{
+    const struct shared_frame *ka = hash_entry(a, struct shared_frame, elem);
+    const struct shared_frame *kb = hash_entry(b, struct shared_frame, elem);
+
+    if (ka->checksum != kb->checksum)
+        return ka->checksum < kb->checksum;
+    return memcmp(ka->kva, kb->kva, PGSIZE) < 0;
+}
+
+/* Frees the candidate that E is embedded in. */
+static void ksm_candidate_free(struct hash_elem *e, void *aux UNUSED)
+{
+    free(hash_entry(e, struct shared_frame, elem));
+}
+
+/* Maps FRAME's page read-only to KSM's contents and frees FRAME, if
+ * the page still holds the same bytes.  Runs with interrupts off, so
+ * that the owner cannot write between the check and the switch, and
+ * a write fault right after it finds PAGE merged.  Caller holds
+ * FRAME_LOCK and KSM_LOCK. */
+static bool ksm_merge(struct frame *frame, struct shared_frame *ksm)
+{
+    struct page *page = frame->page;
+    enum intr_level old_level = intr_disable();
+    bool merged = memcmp(frame->kva, ksm->kva, PGSIZE) == 0 &&
+                  pml4_set_page(page->owner->pml4, page->va, ksm->kva, false);
+    if (merged)
+    {
+        page->frame = NULL;
+        page->shared = ksm;
+    }
+    intr_set_level(old_level);
+
+    if (!merged)
+        return false;
+    frame_table_remove(frame);
+    palloc_free_page(frame->kva);
+    free(frame);
+    rss_sub(page);
+    ksm->sharers++;
+    ksm_merge_cnt++;
+    return true;
+}
+
+/* Turns candidate CAND into a shared frame, in place: its page is
+ * mapped read-only and its frame leaves the frame table.  Fails if the
+ * contents changed since CAND was hashed.  Caller holds FRAME_LOCK and
+ * KSM_LOCK. */
+static bool ksm_promote(struct shared_frame *cand)
+{
+    struct frame *frame = cand->frame;
+    struct page *page = frame->page;
+    enum intr_level old_level = intr_disable();
+    bool promoted = hash_bytes(frame->kva, PGSIZE) == cand->checksum &&
+                    pml4_set_page(page->owner->pml4, page->va, frame->kva, false);
+    if (promoted)
+    {
+        page->frame = NULL;
+        page->shared = cand;
+    }
+    intr_set_level(old_level);
+
+    if (!promoted)
+        return false;
+    frame_table_remove(frame);
+    free(frame);
+    rss_sub(page);
+    cand->frame = NULL;
+    cand->sharers = 1;
+    hash_insert(&ksm_table, &cand->elem);
+    return true;
+}
+
+/* Looks at the next PAGE_CNT frames for merging. */
+static void ksm_scan(size_t page_cnt)
+{
+    struct hash candidates;
+
+    hash_init(&candidates, ksm_frame_hash, ksm_frame_less, NULL);
+    lock_acquire(&frame_lock);
+    for (size_t i = 0; i < page_cnt && !list_empty(&frame_table); i++)
+    {
+        struct shared_frame key, *cand;
+        struct hash_elem *e;
+        struct frame *frame;
+
+        if (ksm_cursor == NULL || ksm_cursor == list_end(&frame_table))
+            ksm_cursor = list_begin(&frame_table);
+        frame = list_entry(ksm_cursor, struct frame, elem);
+        ksm_cursor = list_next(ksm_cursor);
+
+        if (frame->pinned || VM_TYPE(frame->page->operations->type) != VM_ANON)
+            continue;
+
+        key.kva = frame->kva;
+        key.inode = NULL;
+        key.checksum = hash_bytes(frame->kva, PGSIZE);
+
+        lock_acquire(&shared_lock);
+        if ((e = hash_find(&ksm_table, &key.elem)) != NULL)
+            ksm_merge(frame, hash_entry(e, struct shared_frame, elem));
+        else if ((e = hash_find(&candidates, &key.elem)) != NULL)
+        {
+            cand = hash_entry(e, struct shared_frame, elem);
+            if (cand->frame != frame)
+            {
+                hash_delete(&candidates, &cand->elem);
+                if (ksm_promote(cand))
+                    ksm_merge(frame, cand);
+                else
+                    free(cand);
+            }
+        } else if ((cand = malloc(sizeof *cand)) != NULL)
+        {
+            *cand = key;
+            cand->sharers = 0;
+            cand->frame = frame;
+            hash_insert(&candidates, &cand->elem);
+        }
+        lock_release(&shared_lock);
+    }
+    lock_release(&frame_lock);
+    hash_destroy(&candidates, ksm_candidate_free);
+}
+
+/* Kernel thread that merges identical anonymous frames, scanning
+ * ksm_pages_to_scan of them every KSM_INTERVAL ticks.  Runs at the
+ * lowest priority, so it only takes otherwise idle time. */
+static void vm_ksmd(void *aux UNUSED)
+{
+    for (;;)
+    {
+        timer_sleep(KSM_INTERVAL);
+        ksm_scan(ksm_pages_to_scan);
+    }
+}
+
+/* Sets the soft RSS limit of the running process to LIMIT pages, or
+ * removes it if LIMIT is 0.  Eviction takes pages from a process over
+ * its limit before anybody else's. */
+void vm_set_rss_limit(size_t limit)
+{
+    struct supplemental_page_table *spt = &thread_current()->spt;
+
+    lock_acquire(&frame_lock);
+    rss_update(spt, 0, limit);
+    lock_release(&frame_lock);
+}
+
+/* Fills ST with the memory statistics of the running process. */
+void vm_memstat(struct memstat *st)
+{
+    struct supplemental_page_table *spt = &thread_current()->spt;
+
+    lock_acquire(&frame_lock);
+    wss_roll(spt);
+    st->rss = spt->rss;
+    st->wss = spt->wss;
+    st->rss_limit = spt->rss_limit;
+    lock_release(&frame_lock);
+    st->minor_faults = spt->minor_faults;
+    st->major_faults = spt->major_faults;
+}
+
+/* Prints virtual memory statistics. */
+void vm_print_stats(void)
+{
+    size_t text, merged;
+
+    lock_acquire(&shared_lock);
+    text = hash_size(&text_table);
+    merged = hash_size(&ksm_table);
+    lock_release(&shared_lock);
+    printf("Text: %zu shared frames, %lld unshares\n", text, text_unshare_cnt);
+    printf("KSM: %lld merges, %lld unmerges, %zu shared frames\n", ksm_merge_cnt, ksm_unmerge_cnt, merged);
+    vm_anon_print_stats();
+}
+
+/* Drops the queued prefetch requests of T and waits for the one in
+ * service, if it is T's. */
+static void vm_prefetch_cancel(struct thread *t)
+{
+    struct list_elem *e;
+
+    lock_acquire(&prefetch_lock);
+    for (e = list_begin(&prefetch_queue); e != list_end(&prefetch_queue);)
+    {
+        struct prefetch_req *req = list_entry(e, struct prefetch_req, elem);
+        e = list_next(e);
+        if (req->owner == t)
+        {
+            list_remove(&req->elem);
+            free(req);
+        }
+    }
+    while (prefetch_owner == t)
+        cond_wait(&prefetch_idle, &prefetch_lock);
+    lock_release(&prefetch_lock);
+}
+
+/* Returns a hash value for the page that E is embedded in. */
+static uint64_t page_hash(const struct hash_elem *e, void *aux UNUSED)
+{
+    const struct page *page = hash_entry(e, struct page, spt_elem);
+    return hash_bytes(&page->va, sizeof page->va);
+}
+
+/* Returns true if the page A precedes page B. */
+static bool page_less(const struct hash_elem *a, const struct hash_elem *b, void *aux UNUSED)
+{
+    const struct page *page_a = hash_entry(a, struct page, spt_elem);
+    const struct page *page_b = hash_entry(b, struct page, spt_elem);
+    return page_a->va < page_b->va;
 }
 
 /* Initialize new supplemental page table */
-void supplemental_page_table_init(struct supplemental_page_table *spt UNUSED)
+void supplemental_page_table_init(struct supplemental_page_table *spt)
+{
+    hash_init(&spt->pages, page_hash, page_less, NULL);
+    lock_init(&spt->lock);
+    spt->stack_bottom = (void *)USER_STACK;
+    spt->stack_grow_tick = 0;
+    spt->stack_grow_cnt = 1;
+    spt->rss = 0;
+    spt->rss_limit = rss_soft_limit;
+    spt->wss = 0;
+    spt->wss_sample = 0;
+    spt->wss_sweep = clock_sweeps;
+    spt->minor_faults = 0;
+    spt->major_faults = 0;
+}
+
+/* Copies SRC_PAGE, which belongs to another process, into the running
+ * process at the same address. */
+static bool copy_page(struct page *src_page)
 {
+    enum vm_type type = page_get_type(src_page);
+    void *va = src_page->va;
+    struct page *dst_page;
+
+    /* Pages that were never touched stay lazy in the child. */
+    if (VM_TYPE(src_page->operations->type) == VM_UNINIT)
+    {
+        struct uninit_page *uninit = &src_page->uninit;
+        void *aux = NULL;
+
+        if (uninit->aux != NULL && (aux = file_page_duplicate(uninit->aux)) == NULL)
+            return false;
+        if (!vm_alloc_page_with_initializer(uninit->type, va, src_page->writable, uninit->init, aux))
+        {
+            file_page_free(aux);
+            return false;
+        }
+        return true;
+    }
+
+    if (type == VM_FILE)
+    {
+        struct file_page *aux = file_page_duplicate(&src_page->file);
+        if (aux == NULL)
+            return false;
+        if (!vm_alloc_page_with_initializer(VM_FILE, va, src_page->writable, NULL, aux))
+        {
+            file_page_free(aux);
+            return false;
+        }
+    } else if (!vm_alloc_page(type, va, src_page->writable))
+        return false;
+
+    /* Bring the parent's copy in and hold it there while the child's
+     * frame is claimed, which may evict.  A merged page's shared frame
+     * stays put anyway. */
+    if (!vm_claim_frame(src_page, true))
+        return false;
+    vm_frame_pin(src_page);
+    dst_page = spt_find_page(&thread_current()->spt, va);
+    if (!vm_do_claim_page(dst_page))
+    {
+        vm_frame_unpin(src_page);
+        return false;
+    }
+    memcpy(dst_page->frame->kva, src_page->shared != NULL ? src_page->shared->kva : src_page->frame->kva, PGSIZE);
+    dst_page->advice = src_page->advice;
+    vm_frame_unpin(src_page);
+    return true;
 }
 
 /* Copy supplemental page table from src to dst */
-bool supplemental_page_table_copy(struct supplemental_page_table *dst UNUSED,
-                                  struct supplemental_page_table *src UNUSED)
+bool supplemental_page_table_copy(struct supplemental_page_table *dst, struct supplemental_page_table *src)
 {
+    struct hash_iterator i;
+    bool success = true;
+
+    lock_acquire(&src->lock);
+    dst->stack_bottom = src->stack_bottom;
+    dst->rss_limit = src->rss_limit;
+    hash_first(&i, &src->pages);
+    while (success && hash_next(&i))
+        success = copy_page(hash_entry(hash_cur(&i), struct page, spt_elem));
+    lock_release(&src->lock);
+
+    return success;
+}
+
+/* Destroys the page that E is embedded in. */
+static void spt_destroy_page(struct hash_elem *e, void *aux UNUSED)
+{
+    vm_dealloc_page(hash_entry(e, struct page, spt_elem));
 }
 
 /* Free the resource hold by the supplemental page table */
-void supplemental_page_table_kill(struct supplemental_page_table *spt UNUSED)
+void supplemental_page_table_kill(struct supplemental_page_table *spt)
 {
-    /* TODO: Destroy all the supplemental_page_table hold by thread and
-     * TODO: writeback all the modified contents to the storage. */
+    struct tlb_gather tlb;
+
+    /* Destroying a file-backed page writes it back if it is dirty.
+     * The table stays usable, since exec() refills it. */
+    vm_prefetch_cancel(thread_current());
+    lock_acquire(&spt->lock);
+    tlb_gather_begin(&tlb, thread_current()->pml4);
+    hash_clear(&spt->pages, spt_destroy_page);
+    tlb_gather_finish(&tlb);
+    lock_release(&spt->lock);
 }